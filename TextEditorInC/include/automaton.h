@@ -0,0 +1,35 @@
+#ifndef AUTOMATON_H
+#define AUTOMATON_H
+
+#include <stddef.h>
+
+/*** regular expressions ***/
+
+// A pattern is parsed once and compiled to Thompson NFAs for the pattern
+// and its reverse. Searching runs lazily built DFAs over them: each set of
+// NFA states becomes a DFA state the first time it is reached and its
+// transitions are cached, so text is matched in linear time and there is
+// no backtracking to blow up.
+//
+// Syntax: literals, '.', [a-z] and [^...] classes, \d \w \s and their
+// negations, * + ? {n} {n,} {n,m}, | and ( ), ^ and $ at line boundaries.
+// Matches never span lines; '.' and negated classes don't match '\n'.
+
+struct automaton;
+
+// NULL with *error set if the pattern doesn't parse
+struct automaton *automatonCompile(const char *pattern, const char **error);
+void automatonFree(struct automaton *a);
+
+// offset of the first line in text[from, len) with a match, -1 if none;
+// `from` has to be the start of a line
+long automatonFindLine(struct automaton *a, const char *text, size_t len, size_t from);
+
+// leftmost-longest match in line[from, len), where line is one line without
+// its '\n'. Returns 1 and sets [*start, *end) if there is one. To go through
+// a line, call with from 0 and then from past each match; the calls after
+// the first reuse its work, so the line has to stay as it is meanwhile.
+int automatonMatchLine(struct automaton *a, const char *line, size_t len, size_t from,
+                       size_t *start, size_t *end);
+
+#endif //AUTOMATON_H
@@ -10,6 +10,11 @@
 #include <stddef.h>
 #include <time.h>
 #include <termios.h>
+#include <sys/types.h>
+
+#include "lineindex.h"
+#include "rowalloc.h"
+#include "undolog.h"
 
 /*** Defines ***/
 
@@ -17,6 +22,8 @@
 #define TAB_STOP 8
 #define QUIT_TIMES 3
 #define SAVE_TIMES 3
+// flush saved files to disk before renaming them over the old ones
+#define SAVE_FSYNC 1
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -31,6 +38,7 @@ enum editorKeys {
     END_KEY,
     PAGE_UP,
     PAGE_DOWN,
+    PASTE_START,
 };
 
 enum editorHighlight {
@@ -57,38 +65,159 @@ struct editorSyntax {
     char* multilineCommentStart;
     char *multilineCommentEnd;
     int flags;
+    struct keywordTrie *keywordTrie;
+};
+
+/* A tab in a row: its offset in chars and the render offset right after
+ * the spaces it was expanded to. */
+struct rowTab {
+    int at;
+    int end;
+};
+
+/* A run of render bytes with the same highlight class. A row keeps only
+ * its runs that aren't HL_NORMAL, in order, so plain text between them
+ * costs nothing; a run longer than HL_SPAN_MAX is split. */
+struct hlSpan {
+    int start;
+    unsigned int len : 24;
+    unsigned int hl : 8;
 };
 
+#define HL_SPAN_MAX 0xffffff
+
+/* chars holds charsCap bytes and render renderCap bytes, so an edit can
+ * usually patch them in place. hl has room for hlCap spans. saveGen tells a background save
+ * which rows it is still reading from (see editorSave).
+ * In a plain ASCII row every render byte is one column. A row with
+ * multibyte characters also has renderCols, the column of each render byte
+ * and of its end, with all bytes of a character on the same column.
+ * tabs lists the row's tabs in order, which is enough to turn a chars
+ * offset into a render offset and back with a binary search. */
 typedef struct erow {
-    int index;
     int size;
     int rsize;
+    int charsCap;
+    int renderCap;
     char *chars;
     char *render;
-    unsigned char *highlight;
+    int *renderCols;
+    struct rowTab *tabs;
+    int nrTabs;
+    int tabsCap;
+    struct hlSpan *hl;
+    int nrHl;
+    int hlCap;
+    int hlEntryComment;
     int hlOpenComment;
+    int hlDirty;
+    int charsMapped;
+    unsigned int saveGen;
 } erow;
 
-struct editorConfig{
+/* Rows live in an implicit treap ordered by position, so inserting or
+ * deleting a line is O(log n) and a row's line number is derived from its
+ * place in the tree (see rowtree.h). `row` must stay the first member so an
+ * erow pointer can be turned back into its node.
+ * A node with span > 0 stands for `span` lines of a mapped file starting at
+ * line mapLine that have not been materialized into an erow yet.
+ * mark flags a row whose highlighting has to be checked; marked counts the
+ * marks in the subtree so the first one can be found in O(log n). */
+typedef struct rowNode {
+    erow row;
+    struct rowNode *left;
+    struct rowNode *right;
+    struct rowNode *parent;
+    int count;
+    unsigned int priority;
+    int span;
+    int mapLine;
+    int mark;
+    int marked;
+} rowNode;
+
+struct rowTree {
+    rowNode *root;
+};
+
+/* A file opened with editorOpenMapped. index is filled in slices so the
+ * first screen can be drawn before the whole file has been scanned. */
+struct editorMap {
+    char *data;
+    size_t size;
+    size_t scanned;
+    struct lineIndex index;
+    int nrLines;
+    // data is a heap copy of the file, not a mapping (-F, once edited)
+    int copied;
+};
+
+// bytes kept from the end of a followed file
+#define FOLLOW_LAST 64
+
+/* A file followed with -F, as the buffer last caught up with it: the file
+ * at the path, the file the mapping is of (not the same one after a save
+ * renamed a new file over it), and a copy of the file's last bytes to
+ * tell an append from a rewrite. wd is 0 while nothing is watched. */
+struct editorFollow {
+    int wd;
+    int pending;
+    ino_t ino;
+    ino_t mapIno;
+    off_t size;
+    struct timespec mtime;
+    char last[FOLLOW_LAST];
+    int lastLen;
+};
+
+/* What belongs to one open file: its rows and all that is kept about them,
+ * and where the cursor and the view were when it was last shown. Switching
+ * buffers only points E.buf at another one, so its rendered and highlighted
+ * rows, its mapping and its undo history are there as they were left. */
+struct editorBuffer {
     int cursorX, cursorY;
     int rx;
     int rowOff;
     int colOff;
-    int screenrows;
-    int screencols;
     int nrRows;
-    erow *row;
+    struct rowTree rows;
     int dirty;
+    int readOnly;
     char *filename;
+    struct editorSyntax *syntax;
+    struct editorMap map;
+    struct rowHeap heap;
+    struct undoLog undo;
+    struct editorFollow follow;
+};
+
+// the terminal, the screen and the buffer shown on it
+struct editorConfig{
+    struct editorBuffer *buf;
+    struct editorBuffer **buffers;
+    int nrBuffers;
+    // -R: every file opens read-only, as in a pager
+    int pager;
+    // -F: every file is watched and followed as it grows
+    int follow;
+    int screenrows;
+    int screencols;
     char statusMSG[80];
     time_t statusMsgTime;
-    struct editorSyntax *syntax;
+    int frameBytes;
+    long long bytesWritten;
+    long frameAllocs;
+    long frames;
     struct termios orig_termios;
 };
 
 extern struct editorConfig E;
 
 // row operations
+erow *editorRowAt(int at);
+erow *editorRowNext(erow *row);
+erow *editorRowPrev(erow *row);
+int  editorRowIndex(erow *row);
 int  editorRowCxToRx(erow *row, int cursorX);
 int  editorRowRxToCx(erow *row, int rx);
 void editorUpdateRow(erow *row);
@@ -97,15 +226,81 @@ void editorDelRow(int at);
 void editorRowInsertChar(erow *row, int at, int c);
 void editorRowAppenString(erow *row, char *s, size_t len);
 void editorRowDelChar(erow *row, int at);
+void editorRowSplice(erow *row, int at, int removeLen, const char *s, int insertLen);
 void editorFreeRow(erow *row);
 
+// syntax highlighting
+void editorSelectSyntaxHighlight(void);
+void editorUpdateSyntax(erow *row);
+unsigned char editorRowHighlightAt(const erow *row, int at);
+void editorSyntaxEnsure(erow *row);
+int  editorSyntaxBackground(int budget);
+void editorSyntaxAll(int threads);
+
+// undo
+int    editorUndo(void);
+int    editorRedo(void);
+void   editorUndoSeal(void);
+void   editorUndoClear(void);
+void   editorUndoSetBudget(size_t bytes);
+size_t editorUndoBytes(void);
+
+// find
+void editorFindCallback(char *query, int key);
+int  editorFindPoll(void);
+
+// output
+void editorRefreshScreen(void);
+void editorDrawRows(void);
+void editorSetStatusMessage(const char *fmt, ...);
+void screenInvalidate(void);
+
+// input
+int  editorReadKey(void);
+void editorProcessKeypress(void);
+void editorProcessInput(void);
+
+// event loop
+void editorEventsInit(void);
+void editorWake(void);
+int  editorTimersFire(double now);
+int  editorIdle(void);
+
+// buffers
+struct editorBuffer *editorBufferNew(void);
+int  editorBufferIndex(void);
+void editorBufferSwitch(int index);
+void editorBufferClose(int index);
+void editorBufferOpen(char *filename);
+
+// memory
+void editorMemoryReport(int fd);
+
+// replay
+void editorReplayBegin(int rows, int cols);
+int  editorReplayStep(void);
+void editorReplayReport(int fd);
+
 // editor operations
 void editorInserChar(int c);
 void editorInsertNewLine(void);
 void editorDelChar(void);
+void editorInsertText(const char *text, size_t len);
 
 // file I/O helpers
 char *editorRowToString(int *bufLen);
+int   editorOpen(char *filename);
+void  editorSave(void);
+int   editorSavePoll(void);
+void  editorSaveWait(void);
+int   editorOpenMapped(char *filename);
+void  editorMapIndexSlice(size_t budget);
+void  editorMapFinishIndex(void);
+int   editorMapIndexing(void);
+void  editorCloseFile(void);
+void  editorPagerTrim(void);
+void  editorFollowStart(void);
+int   editorFollowPoll(void);
 
 
 #endif //EDITOR_H
@@ -0,0 +1,36 @@
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+/*** character classes ***/
+
+#define CC_SEPARATOR (1<<0)
+#define CC_DIGIT     (1<<1)
+
+extern const unsigned char charClass[256];
+
+#define isSeparatorByte(c) (charClass[(unsigned char)(c)] & CC_SEPARATOR)
+
+/*** keyword trie ***/
+
+// A keyword list ("int|" style, see editorSyntax) compiled into a trie over
+// the bytes that actually occur in it. Matching costs one table step per
+// byte of the token no matter how many keywords there are.
+
+struct keywordTrie {
+    unsigned char map[256];
+    int alphabet;
+    int *next;
+    int *keyword;
+    unsigned char *type;
+    int nrNodes;
+    int capNodes;
+};
+
+struct keywordTrie *keywordTrieBuild(char **keywords, unsigned char kw1, unsigned char kw2);
+void keywordTrieFree(struct keywordTrie *trie);
+
+// length of the keyword at the start of s[0, len) that is followed by a
+// separator or the end, 0 if none; *type gets its highlight class
+int keywordTrieMatch(const struct keywordTrie *trie, const char *s, int len, unsigned char *type);
+
+#endif //KEYWORDS_H
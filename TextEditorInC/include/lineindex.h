@@ -0,0 +1,48 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*** line index ***/
+
+// Line starts are stored as one 64-bit base per LINE_BLOCK lines plus a
+// 32-bit delta per line, about 4 bytes a line instead of 8. A line that
+// starts 4 GB or more past its block base goes to a small overflow table.
+
+#define LINE_BLOCK 64
+
+enum lineScanner {
+    LINE_SCAN_AUTO = 0,
+    LINE_SCAN_SCALAR,
+    LINE_SCAN_SSE2,
+    LINE_SCAN_AVX2
+};
+
+struct lineIndex {
+    uint64_t *base;
+    uint32_t *delta;
+    int nrStarts;
+    int cap;
+    uint64_t *overflow;
+    int nrOverflow;
+    int hasCR;
+};
+
+void   lineIndexInit(struct lineIndex *idx);
+void   lineIndexFree(struct lineIndex *idx);
+void   lineIndexAdd(struct lineIndex *idx, size_t start);
+size_t lineIndexStart(const struct lineIndex *idx, int line);
+int    lineIndexLineAt(const struct lineIndex *idx, size_t offset);
+const char *lineIndexLine(const struct lineIndex *idx, const char *data, size_t size,
+                          int line, size_t *len);
+size_t lineIndexBytes(const struct lineIndex *idx);
+
+// adds a start after every '\n' in data[from, to) that isn't the last byte
+// of a size-byte buffer
+void   lineIndexScan(struct lineIndex *idx, const char *data, size_t from, size_t to, size_t size);
+
+int         lineIndexUseScanner(enum lineScanner scanner);
+const char *lineIndexScannerName(void);
+
+#endif //LINEINDEX_H
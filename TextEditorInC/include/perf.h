@@ -0,0 +1,64 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stddef.h>
+
+/*** frame profiling ***/
+
+// Phases are pushed and popped around the parts of the editor that make up
+// a frame. Time is charged to whichever phase is on top, so a phase's time
+// doesn't include the phases nested in it. A frame runs from the end of
+// the last one to its final write. Waiting for input and background work
+// are tracked too, but a frame never counts them. With tracing on, every
+// phase is also kept as an event and written out as Chrome trace JSON,
+// which chrome://tracing and Perfetto both open.
+// All of it happens on the main thread only.
+
+enum perfPhase {
+    PERF_OTHER = 0,
+    PERF_INPUT,
+    PERF_EDIT,
+    PERF_SYNTAX,
+    PERF_DRAW,
+    PERF_DIFF,
+    PERF_WRITE,
+    PERF_WAIT,
+    PERF_IDLE,
+    PERF_PHASES
+};
+
+#define PERF_HISTORY 32
+#define PERF_MAX_EVENTS (1 << 20)
+
+// hud and trace are each turned on by perfEnable; profiling costs one
+// branch per phase while both are off
+extern int perfOn;
+
+void perfEnable(int hud, int trace);
+int  perfHud(void);
+
+void perfPushSlow(int phase);
+void perfPopSlow(void);
+
+static inline void perfPush(int phase) {
+    if (perfOn) perfPushSlow(phase);
+}
+
+static inline void perfPop(void) {
+    if (perfOn) perfPopSlow();
+}
+
+// ends the frame that `bytes` of output were just written for
+void perfFrameEnd(size_t bytes);
+
+// mean over the last PERF_HISTORY frames: the whole frame and each phase,
+// in seconds, and bytes written; returns the number of frames it covers
+int perfRolling(double *frame, double phases[PERF_PHASES], double *bytes);
+
+// writes the status bar text for the rolling numbers
+int perfHudText(char *buf, size_t size);
+
+// writes the recorded events as Chrome trace JSON; -1 if it can't
+int perfWriteTrace(const char *path);
+
+#endif //PERF_H
@@ -0,0 +1,55 @@
+#ifndef ROWALLOC_H
+#define ROWALLOC_H
+
+#include <stddef.h>
+
+/*** row allocator ***/
+
+// Row buffers come from size classes about 1.5x apart, carved out of
+// ROW_SLAB_SIZE slabs. A freed block goes on its class's free list for the
+// next block of that size, so loading a file costs a malloc per slab rather
+// than per row, and editing reuses blocks instead of fragmenting the heap.
+// Blocks over ROW_SMALL_MAX go to malloc. Callers pass back the size they
+// asked for, so blocks carry no header. To use a class's slack, round sizes
+// with rowAllocSize. A heap releases every slab at once when its buffer is
+// closed.
+
+#define ROW_SLAB_SIZE (64 << 10)
+#define ROW_SMALL_MAX 4096
+#define ROW_CLASSES 16
+
+enum rowKind {
+    ROW_CHARS = 0,
+    ROW_RENDER,
+    ROW_COLS,
+    ROW_TABS,
+    ROW_HL,
+    ROW_KINDS
+};
+
+struct rowHeap {
+    void *freeList[ROW_CLASSES];
+    char *bump;
+    size_t bumpLeft;
+    void *slabs;
+    size_t slabBytes;
+    size_t largeBytes;
+    size_t used[ROW_KINDS];
+    size_t blocks[ROW_KINDS];
+};
+
+// the size of the block a request for `size` bytes gets
+size_t rowAllocSize(size_t size);
+
+void *rowAlloc(struct rowHeap *heap, int kind, size_t size);
+// keeps min(oldSize, size) bytes; p may be NULL with oldSize 0
+void *rowRealloc(struct rowHeap *heap, int kind, void *p, size_t oldSize, size_t size);
+void  rowFree(struct rowHeap *heap, int kind, void *p, size_t size);
+
+// frees every slab; only once no block from the heap is in use
+void rowHeapRelease(struct rowHeap *heap);
+
+// bytes held in slabs but not handed out: free lists and the slab tail
+size_t rowHeapSlack(const struct rowHeap *heap);
+
+#endif //ROWALLOC_H
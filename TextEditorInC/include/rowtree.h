@@ -0,0 +1,27 @@
+#ifndef ROWTREE_H
+#define ROWTREE_H
+
+#include "editor.h"
+
+/*** row tree ***/
+
+// Every operation is O(log n) expected; a node's position is never stored,
+// it is recomputed from subtree counts on the way up to the root. Positions
+// count lines, so a span node covers `span` consecutive positions.
+
+rowNode *rowTreeNewNode(void);
+int      rowTreeCount(const struct rowTree *tree);
+rowNode *rowTreeAt(const struct rowTree *tree, int at, int *offset);
+int      rowTreeIndexOf(const rowNode *node);
+void     rowTreeInsert(struct rowTree *tree, int at, rowNode *node);
+void     rowTreeRemove(struct rowTree *tree, rowNode *node);
+void     rowTreeResize(rowNode *node, int span);
+void     rowTreeClear(struct rowTree *tree, void (*release)(rowNode *node));
+void     rowTreeSetMark(rowNode *node, int mark);
+void     rowTreeMarkAll(struct rowTree *tree);
+void     rowTreeClearMarks(struct rowTree *tree);
+rowNode *rowTreeFirstMarked(const struct rowTree *tree);
+rowNode *rowTreeNext(rowNode *node);
+rowNode *rowTreePrev(rowNode *node);
+
+#endif //ROWTREE_H
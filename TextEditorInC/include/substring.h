@@ -0,0 +1,25 @@
+#ifndef SUBSTRING_H
+#define SUBSTRING_H
+
+#include <stddef.h>
+
+/*** substring search ***/
+
+// The SIMD engines compare the first and last byte of the needle against a
+// whole block of the haystack at once and only memcmp the positions where
+// both agree. The scalar engine is libc memmem (two-way on glibc).
+
+enum substringEngine {
+    SUBSTRING_AUTO = 0,
+    SUBSTRING_SCALAR,
+    SUBSTRING_SSE2,
+    SUBSTRING_AVX2
+};
+
+// first occurrence of needle[0, nlen) in hay[0, len), NULL if none
+const char *substringFind(const char *hay, size_t len, const char *needle, size_t nlen);
+
+int         substringUseEngine(enum substringEngine engine);
+const char *substringEngineName(void);
+
+#endif //SUBSTRING_H
@@ -0,0 +1,73 @@
+#ifndef UNDOLOG_H
+#define UNDOLOG_H
+
+#include <stddef.h>
+
+/*** undo log ***/
+
+// Edits are recorded as ops packed back to back in one buffer: a fixed
+// header followed by the text the op inserted or removed. Each undo step
+// starts with an UNDO_GROUP op. Ops between [head, end) can be undone,
+// ops between [end, top) redone. Typing into a row grows the last op
+// instead of adding one per character. When the log is over its budget,
+// the oldest steps are dropped.
+
+#define UNDO_BUDGET (8 << 20)
+
+enum undoType {
+    UNDO_GROUP = 0,
+    UNDO_INSERT_CHARS,
+    UNDO_DELETE_CHARS,
+    UNDO_INSERT_ROW,
+    UNDO_DELETE_ROW
+};
+
+/* row/at is where the op applies; for UNDO_GROUP it is the cursor before
+ * the step and the len text bytes hold the cursor after it. back is the
+ * distance to the previous op, so the log can be walked both ways. */
+struct undoOp {
+    int type;
+    int back;
+    int row;
+    int at;
+    int len;
+};
+
+struct undoLog {
+    char *data;
+    size_t cap;
+    size_t head;
+    size_t end;
+    size_t top;
+    size_t budget;
+    size_t last;
+    size_t group;
+    int open;
+};
+
+void undoLogFree(struct undoLog *log);
+void undoLogSetBudget(struct undoLog *log, size_t budget);
+
+// starts a step if none is open, then adds or merges an op into it
+void undoLogAdd(struct undoLog *log, int type, int row, int at, const char *text, int len,
+                int cursorRow, int cursorAt);
+// closes the open step, so the next op starts a new one
+void undoLogSeal(struct undoLog *log, int cursorRow, int cursorAt);
+
+// the group op of the step to undo or redo, NULL if there is none; moves
+// end past it
+struct undoOp *undoLogUndo(struct undoLog *log);
+struct undoOp *undoLogRedo(struct undoLog *log);
+
+// neighbours of an op within its step, NULL past either end
+struct undoOp *undoLogNext(const struct undoLog *log, const struct undoOp *op);
+struct undoOp *undoLogPrev(const struct undoLog *log, const struct undoOp *op);
+
+static inline const char *undoOpText(const struct undoOp *op) {
+    return (const char *)(op + 1);
+}
+
+void   undoLogCursorAfter(const struct undoOp *group, int *row, int *at);
+size_t undoLogBytes(const struct undoLog *log);
+
+#endif //UNDOLOG_H
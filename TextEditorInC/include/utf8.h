@@ -5,13 +5,40 @@
 #ifndef UTF8_H
 #define UTF8_H
 
+#include <stddef.h>
+
 #include "editor.h"
 
+/*** utf-8 ***/
+
+// Rows are kept as the raw bytes of the file. Text that doesn't decode
+// (stray continuation bytes, overlong forms, surrogates, cut off sequences)
+// is taken one byte at a time and shown as a one column '?', so any file
+// round-trips unchanged. Most lines are plain ASCII; utf8AsciiPrefix finds
+// that out a whole vector at a time so they skip the per-character work.
+
 int utf8CharLen(const unsigned char *s);
 int utf8IsStartByte(unsigned char c);
 
+// decodes the character at s[0, len) into *cp and returns its length;
+// an invalid sequence gives *cp = -1 and length 1
+int utf8Decode(const char *s, int len, int *cp);
+
+// columns a code point takes on the terminal: 2 for wide (CJK, emoji),
+// 0 for combining marks and other zero width characters, 1 otherwise
+int utf8Width(int cp);
+
+// length of the run of ASCII bytes at the start of s[0, len)
+size_t utf8AsciiPrefix(const char *s, size_t len);
+
+// the cursor positions around cx; combining marks stay with the character
+// they follow, so the cursor never lands between them
 int utf8NextCharIndex(const erow *row, int cx);
 
 int utf8PrevCharIndex(const erow *row, int cx);
 
+// start of the character cx falls in, for a cursor carried over from
+// another row
+int utf8CharStart(const erow *row, int cx);
+
 #endif //UTF8_H
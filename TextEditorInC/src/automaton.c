@@ -0,0 +1,712 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/automaton.h"
+
+// the symbol fed after the last byte of a line
+#define SYM_END 256
+#define NR_SYMBOLS 257
+// largest n accepted in {n,m}
+#define REPEAT_MAX 1000
+// patterns that would need more NFA states than this are refused
+#define NFA_MAX_STATES 100000
+// DFA states cached before the cache is thrown away and rebuilt
+#define DFA_MAX_STATES 2048
+
+/*** syntax tree ***/
+
+enum reType { RE_EMPTY, RE_SET, RE_CAT, RE_ALT, RE_STAR, RE_PLUS, RE_QUEST, RE_BOL, RE_EOL };
+
+// subtrees may be shared (a{3} refers to `a` three times); each reference
+// is compiled to its own NFA states
+struct reNode {
+    int type;
+    int left;
+    int right;
+    int set;
+};
+
+typedef uint64_t byteSet[4];
+
+struct parser {
+    const char *p;
+    const char *error;
+    struct reNode *nodes;
+    int nrNodes;
+    int capNodes;
+    byteSet *sets;
+    int nrSets;
+    int capSets;
+};
+
+static int newNode(struct parser *ps, int type, int left, int right, int set) {
+    if (ps->nrNodes == ps->capNodes) {
+        ps->capNodes = ps->capNodes ? ps->capNodes * 2 : 64;
+        ps->nodes = realloc(ps->nodes, sizeof(struct reNode) * ps->capNodes);
+        if (ps->nodes == NULL) abort();
+    }
+    ps->nodes[ps->nrNodes] = (struct reNode){ type, left, right, set };
+    return ps->nrNodes++;
+}
+
+static int newSet(struct parser *ps) {
+    if (ps->nrSets == ps->capSets) {
+        ps->capSets = ps->capSets ? ps->capSets * 2 : 16;
+        ps->sets = realloc(ps->sets, sizeof(byteSet) * ps->capSets);
+        if (ps->sets == NULL) abort();
+    }
+    memset(ps->sets[ps->nrSets], 0, sizeof(byteSet));
+    return ps->nrSets++;
+}
+
+static void setAdd(uint64_t *set, unsigned char lo, unsigned char hi) {
+    for (int c = lo; c <= hi; c++) {
+        set[c >> 6] |= (uint64_t)1 << (c & 63);
+    }
+}
+
+static int setHas(const uint64_t *set, int c) {
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+// complements a set; '\n' never matches anything
+static void setNegate(uint64_t *set) {
+    for (int i = 0; i < 4; i++) set[i] = ~set[i];
+    set['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+}
+
+static int cat(struct parser *ps, int a, int b) {
+    if (ps->nodes[a].type == RE_EMPTY) return b;
+    if (ps->nodes[b].type == RE_EMPTY) return a;
+    return newNode(ps, RE_CAT, a, b, -1);
+}
+
+// adds the bytes an escape stands for to `set`
+static void parseEscape(char c, uint64_t *set) {
+    byteSet tmp = {0};
+    switch (c) {
+        case 'd': case 'D':
+            setAdd(tmp, '0', '9');
+            break;
+        case 'w': case 'W':
+            setAdd(tmp, 'a', 'z');
+            setAdd(tmp, 'A', 'Z');
+            setAdd(tmp, '0', '9');
+            setAdd(tmp, '_', '_');
+            break;
+        case 's': case 'S':
+            setAdd(tmp, ' ', ' ');
+            setAdd(tmp, '\t', '\r');
+            break;
+        case 't':
+            setAdd(tmp, '\t', '\t');
+            break;
+        default:
+            setAdd(tmp, c, c);
+            break;
+    }
+    if (c == 'D' || c == 'W' || c == 'S') setNegate(tmp);
+    for (int i = 0; i < 4; i++) set[i] |= tmp[i];
+}
+
+static int parseClass(struct parser *ps) {
+    int set = newSet(ps);
+    int negate = 0;
+    ps->p++;
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+
+    int first = 1;
+    while (*ps->p != ']' || first) {
+        first = 0;
+        if (*ps->p == '\0') {
+            ps->error = "missing ]";
+            return -1;
+        }
+        unsigned char lo = *ps->p++;
+        if (lo == '\\') {
+            if (*ps->p == '\0') {
+                ps->error = "trailing \\";
+                return -1;
+            }
+            char esc = *ps->p++;
+            if (strchr("dDwWsS", esc)) {
+                parseEscape(esc, ps->sets[set]);
+                continue;
+            }
+            lo = (esc == 't') ? '\t' : esc;
+        }
+        unsigned char hi = lo;
+        if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+            ps->p++;
+            hi = *ps->p++;
+            if (hi == '\\' && *ps->p) hi = *ps->p++;
+            if (hi < lo) {
+                ps->error = "bad range";
+                return -1;
+            }
+        }
+        setAdd(ps->sets[set], lo, hi);
+    }
+    ps->p++;
+
+    if (negate) setNegate(ps->sets[set]);
+    return newNode(ps, RE_SET, -1, -1, set);
+}
+
+static int parseAlt(struct parser *ps);
+
+static int parseAtom(struct parser *ps) {
+    char c = *ps->p;
+    int set;
+
+    switch (c) {
+        case '(': {
+            ps->p++;
+            int node = parseAlt(ps);
+            if (ps->error) return -1;
+            if (*ps->p != ')') {
+                ps->error = "missing )";
+                return -1;
+            }
+            ps->p++;
+            return node;
+        }
+        case '[':
+            return parseClass(ps);
+        case '^':
+            ps->p++;
+            return newNode(ps, RE_BOL, -1, -1, -1);
+        case '$':
+            ps->p++;
+            return newNode(ps, RE_EOL, -1, -1, -1);
+        case '*': case '+': case '?':
+            ps->error = "nothing to repeat";
+            return -1;
+        case '.':
+            ps->p++;
+            set = newSet(ps);
+            setNegate(ps->sets[set]);
+            return newNode(ps, RE_SET, -1, -1, set);
+        case '\\':
+            ps->p++;
+            if (*ps->p == '\0') {
+                ps->error = "trailing \\";
+                return -1;
+            }
+            set = newSet(ps);
+            parseEscape(*ps->p++, ps->sets[set]);
+            return newNode(ps, RE_SET, -1, -1, set);
+        default:
+            ps->p++;
+            set = newSet(ps);
+            setAdd(ps->sets[set], c, c);
+            return newNode(ps, RE_SET, -1, -1, set);
+    }
+}
+
+// reads "{n}", "{n,}" or "{n,m}"; anything else leaves '{' to be a literal
+static int parseCount(struct parser *ps, int *min, int *max) {
+    const char *p = ps->p + 1;
+    if (*p < '0' || *p > '9') return 0;
+    *min = 0;
+    while (*p >= '0' && *p <= '9') {
+        *min = *min * 10 + (*p++ - '0');
+        if (*min > REPEAT_MAX) *min = REPEAT_MAX + 1;
+    }
+    *max = *min;
+    if (*p == ',') {
+        p++;
+        *max = -1;
+        if (*p >= '0' && *p <= '9') {
+            *max = 0;
+            while (*p >= '0' && *p <= '9') {
+                *max = *max * 10 + (*p++ - '0');
+                if (*max > REPEAT_MAX) *max = REPEAT_MAX + 1;
+            }
+        }
+    }
+    if (*p != '}') return 0;
+    ps->p = p + 1;
+    return 1;
+}
+
+static int parseRepeat(struct parser *ps) {
+    int node = parseAtom(ps);
+    while (!ps->error) {
+        char c = *ps->p;
+        int min, max;
+        if (c == '*') {
+            node = newNode(ps, RE_STAR, node, -1, -1);
+        }else if (c == '+') {
+            node = newNode(ps, RE_PLUS, node, -1, -1);
+        }else if (c == '?') {
+            node = newNode(ps, RE_QUEST, node, -1, -1);
+        }else if (c == '{' && parseCount(ps, &min, &max)) {
+            if (min > REPEAT_MAX || max > REPEAT_MAX || (max != -1 && max < min)) {
+                ps->error = "bad repeat count";
+                return -1;
+            }
+            // x{2,4} is x x (x x?)?, x{2,} is x x x*
+            int empty = newNode(ps, RE_EMPTY, -1, -1, -1);
+            int result = empty;
+            for (int i = 0; i < min; i++) result = cat(ps, result, node);
+            if (max == -1) {
+                result = cat(ps, result, newNode(ps, RE_STAR, node, -1, -1));
+            }else {
+                int tail = empty;
+                for (int i = min; i < max; i++) {
+                    tail = newNode(ps, RE_QUEST, cat(ps, node, tail), -1, -1);
+                }
+                result = cat(ps, result, tail);
+            }
+            node = result;
+            continue;
+        }else {
+            break;
+        }
+        ps->p++;
+    }
+    return node;
+}
+
+static int parseCat(struct parser *ps) {
+    int node = newNode(ps, RE_EMPTY, -1, -1, -1);
+    while (*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->error) {
+        int next = parseRepeat(ps);
+        if (ps->error) return -1;
+        node = cat(ps, node, next);
+    }
+    return node;
+}
+
+static int parseAlt(struct parser *ps) {
+    int node = parseCat(ps);
+    while (!ps->error && *ps->p == '|') {
+        ps->p++;
+        int next = parseCat(ps);
+        if (ps->error) return -1;
+        node = newNode(ps, RE_ALT, node, next, -1);
+    }
+    return node;
+}
+
+/*** NFA ***/
+
+enum nfaType { NFA_SET, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+struct nfaState {
+    int type;
+    int out;
+    int out1;
+    int set;
+};
+
+struct nfa {
+    struct nfaState *states;
+    int nrStates;
+    int capStates;
+    int start;
+};
+
+static int nfaAdd(struct nfa *nfa, int type, int out, int out1, int set) {
+    if (nfa->nrStates == NFA_MAX_STATES) return -1;
+    if (nfa->nrStates == nfa->capStates) {
+        nfa->capStates = nfa->capStates ? nfa->capStates * 2 : 64;
+        nfa->states = realloc(nfa->states, sizeof(struct nfaState) * nfa->capStates);
+        if (nfa->states == NULL) abort();
+    }
+    nfa->states[nfa->nrStates] = (struct nfaState){ type, out, out1, set };
+    return nfa->nrStates++;
+}
+
+/* Emits the states for `node` followed by state `next` and returns the
+ * first one, or -1 if the NFA got too big. Built back to front, so `next`
+ * always exists already; `reverse` builds the NFA for reversed text. */
+static int nfaEmit(struct nfa *nfa, const struct reNode *nodes, int node, int next, int reverse) {
+    if (next == -1) return -1;
+    const struct reNode *n = &nodes[node];
+    int first, second, split;
+
+    switch (n->type) {
+        case RE_SET:
+            return nfaAdd(nfa, NFA_SET, next, -1, n->set);
+        case RE_CAT:
+            first = reverse ? n->left : n->right;
+            second = reverse ? n->right : n->left;
+            return nfaEmit(nfa, nodes, second, nfaEmit(nfa, nodes, first, next, reverse), reverse);
+        case RE_ALT:
+            first = nfaEmit(nfa, nodes, n->left, next, reverse);
+            second = nfaEmit(nfa, nodes, n->right, next, reverse);
+            if (first == -1 || second == -1) return -1;
+            return nfaAdd(nfa, NFA_SPLIT, first, second, -1);
+        case RE_STAR:
+        case RE_PLUS:
+            split = nfaAdd(nfa, NFA_SPLIT, -1, next, -1);
+            first = nfaEmit(nfa, nodes, n->left, split, reverse);
+            if (first == -1) return -1;
+            nfa->states[split].out = first;
+            return (n->type == RE_STAR) ? split : first;
+        case RE_QUEST:
+            first = nfaEmit(nfa, nodes, n->left, next, reverse);
+            if (first == -1) return -1;
+            return nfaAdd(nfa, NFA_SPLIT, first, next, -1);
+        case RE_BOL:
+            return nfaAdd(nfa, reverse ? NFA_EOL : NFA_BOL, next, -1, -1);
+        case RE_EOL:
+            return nfaAdd(nfa, reverse ? NFA_BOL : NFA_EOL, next, -1, -1);
+        default:
+            return next;
+    }
+}
+
+/*** lazy DFA ***/
+
+/* A DFA state is the set of NFA states reached after some input, before
+ * following any empty transitions, plus whether that input ended a line.
+ * Empty transitions are followed when a transition is first computed, once
+ * the next symbol is known, so ^ and $ can be decided there. match has a
+ * bit per symbol: a match ended right before that symbol. */
+struct dfaState {
+    int *nfa;
+    int nrNfa;
+    int bol;
+    int next[NR_SYMBOLS];
+    uint64_t match[(NR_SYMBOLS + 63) / 64];
+};
+
+struct dfa {
+    const struct nfa *nfa;
+    const byteSet *sets;
+    int unanchored;
+    struct dfaState *states;
+    int nrStates;
+    int *table;
+    int start[2];
+    int *stack;
+    int *visited;
+    int *target;
+    unsigned char *mark;
+};
+
+#define DFA_TABLE_SIZE (DFA_MAX_STATES * 2)
+
+static void dfaInit(struct dfa *d, const struct nfa *nfa, const byteSet *sets, int unanchored) {
+    memset(d, 0, sizeof(*d));
+    d->nfa = nfa;
+    d->sets = sets;
+    d->unanchored = unanchored;
+    d->states = malloc(sizeof(struct dfaState) * DFA_MAX_STATES);
+    d->table = malloc(sizeof(int) * DFA_TABLE_SIZE);
+    // the seeds, the start state and two outgoing edges per visited state
+    d->stack = malloc(sizeof(int) * (3 * nfa->nrStates + 1));
+    d->visited = malloc(sizeof(int) * nfa->nrStates);
+    d->target = malloc(sizeof(int) * nfa->nrStates);
+    d->mark = calloc(nfa->nrStates, 1);
+    if (!d->states || !d->table || !d->stack || !d->visited || !d->target || !d->mark) abort();
+    memset(d->table, -1, sizeof(int) * DFA_TABLE_SIZE);
+    d->start[0] = d->start[1] = -1;
+}
+
+static void dfaFlush(struct dfa *d) {
+    for (int i = 0; i < d->nrStates; i++) free(d->states[i].nfa);
+    d->nrStates = 0;
+    memset(d->table, -1, sizeof(int) * DFA_TABLE_SIZE);
+    d->start[0] = d->start[1] = -1;
+}
+
+static void dfaFree(struct dfa *d) {
+    dfaFlush(d);
+    free(d->states);
+    free(d->table);
+    free(d->stack);
+    free(d->visited);
+    free(d->target);
+    free(d->mark);
+}
+
+static unsigned int dfaHash(const int *nfa, int n, int bol) {
+    unsigned int h = 2166136261u ^ bol;
+    for (int i = 0; i < n; i++) h = (h ^ nfa[i]) * 16777619u;
+    return h;
+}
+
+// the cached state for a set of NFA states, added if new; a full cache is
+// emptied first, which invalidates every state index handed out before
+static int dfaState(struct dfa *d, const int *nfa, int n, int bol, int *flushed) {
+    unsigned int slot = dfaHash(nfa, n, bol) & (DFA_TABLE_SIZE - 1);
+    for (int i = d->table[slot]; i != -1; i = d->table[slot]) {
+        struct dfaState *st = &d->states[i];
+        if (st->bol == bol && st->nrNfa == n && memcmp(st->nfa, nfa, sizeof(int) * n) == 0) return i;
+        slot = (slot + 1) & (DFA_TABLE_SIZE - 1);
+    }
+
+    if (d->nrStates == DFA_MAX_STATES) {
+        dfaFlush(d);
+        *flushed = 1;
+        slot = dfaHash(nfa, n, bol) & (DFA_TABLE_SIZE - 1);
+    }
+
+    int i = d->nrStates++;
+    struct dfaState *st = &d->states[i];
+    st->nfa = malloc(sizeof(int) * (n ? n : 1));
+    if (st->nfa == NULL) abort();
+    memcpy(st->nfa, nfa, sizeof(int) * n);
+    st->nrNfa = n;
+    st->bol = bol;
+    memset(st->next, -1, sizeof(st->next));
+    memset(st->match, 0, sizeof(st->match));
+    d->table[slot] = i;
+    return i;
+}
+
+static int dfaStart(struct dfa *d, int bol) {
+    if (d->start[bol] == -1) {
+        int flushed = 0;
+        d->start[bol] = dfaState(d, &d->nfa->start, 1, bol, &flushed);
+    }
+    return d->start[bol];
+}
+
+static int intCompare(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static int dfaCompute(struct dfa *d, int s, int c, int *matched) {
+    const struct nfaState *states = d->nfa->states;
+    struct dfaState *st = &d->states[s];
+    int bol = st->bol;
+    int eol = (c == '\n' || c == SYM_END);
+
+    int top = 0;
+    int nrVisited = 0;
+    for (int i = 0; i < st->nrNfa; i++) d->stack[top++] = st->nfa[i];
+    if (d->unanchored) d->stack[top++] = d->nfa->start;
+
+    *matched = 0;
+    while (top > 0) {
+        int x = d->stack[--top];
+        if (x == -1 || d->mark[x]) continue;
+        d->mark[x] = 1;
+        d->visited[nrVisited++] = x;
+        switch (states[x].type) {
+            case NFA_SPLIT:
+                d->stack[top++] = states[x].out;
+                d->stack[top++] = states[x].out1;
+                break;
+            case NFA_BOL:
+                if (bol) d->stack[top++] = states[x].out;
+                break;
+            case NFA_EOL:
+                if (eol) d->stack[top++] = states[x].out;
+                break;
+            case NFA_MATCH:
+                *matched = 1;
+                break;
+        }
+    }
+    for (int i = 0; i < nrVisited; i++) d->mark[d->visited[i]] = 0;
+
+    int n = 0;
+    if (c != SYM_END) {
+        for (int i = 0; i < nrVisited; i++) {
+            const struct nfaState *x = &states[d->visited[i]];
+            if (x->type == NFA_SET && setHas(d->sets[x->set], c) && !d->mark[x->out]) {
+                d->mark[x->out] = 1;
+                d->target[n++] = x->out;
+            }
+        }
+        for (int i = 0; i < n; i++) d->mark[d->target[i]] = 0;
+        qsort(d->target, n, sizeof(int), intCompare);
+    }
+
+    int flushed = 0;
+    int next = dfaState(d, d->target, n, c == '\n', &flushed);
+    if (!flushed) {
+        st = &d->states[s];
+        st->next[c] = next;
+        if (*matched) st->match[c >> 6] |= (uint64_t)1 << (c & 63);
+    }
+    return next;
+}
+
+// moves on by one symbol; *matched is set if a match ended before it
+static inline int dfaStep(struct dfa *d, int s, int c, int *matched) {
+    int next = d->states[s].next[c];
+    if (next != -1) {
+        *matched = (d->states[s].match[c >> 6] >> (c & 63)) & 1;
+        return next;
+    }
+    return dfaCompute(d, s, c, matched);
+}
+
+static int dfaDead(const struct dfa *d, int s) {
+    return !d->unanchored && d->states[s].nrNfa == 0;
+}
+
+/*** automaton ***/
+
+/* The reverse pass over the line last matched: a bit per offset where a
+ * match starts, set for [low, len], and the reverse DFA's state at low so
+ * a call further left can carry on from there. */
+struct lineStarts {
+    const char *line;
+    size_t len;
+    size_t low;
+    int state;
+    uint64_t *bits;
+    size_t cap;
+};
+
+struct automaton {
+    byteSet *sets;
+    struct nfa forward;
+    struct nfa backward;
+    struct dfa search;
+    struct dfa anchored;
+    struct dfa reverse;
+    struct lineStarts starts;
+};
+
+struct automaton *automatonCompile(const char *pattern, const char **error) {
+    struct parser ps = {0};
+    ps.p = pattern;
+    int root = parseAlt(&ps);
+    if (!ps.error && *ps.p == ')') ps.error = "unmatched )";
+
+    struct automaton *a = NULL;
+    if (!ps.error) {
+        a = calloc(1, sizeof(struct automaton));
+        if (a == NULL) abort();
+        a->sets = ps.sets;
+        ps.sets = NULL;
+
+        int match = nfaAdd(&a->forward, NFA_MATCH, -1, -1, -1);
+        a->forward.start = nfaEmit(&a->forward, ps.nodes, root, match, 0);
+        match = nfaAdd(&a->backward, NFA_MATCH, -1, -1, -1);
+        a->backward.start = nfaEmit(&a->backward, ps.nodes, root, match, 1);
+
+        if (a->forward.start == -1 || a->backward.start == -1) {
+            ps.error = "pattern too large";
+            free(a->forward.states);
+            free(a->backward.states);
+            free(a->sets);
+            free(a);
+            a = NULL;
+        }else {
+            dfaInit(&a->search, &a->forward, a->sets, 1);
+            dfaInit(&a->anchored, &a->forward, a->sets, 0);
+            dfaInit(&a->reverse, &a->backward, a->sets, 1);
+        }
+    }
+
+    if (error) *error = ps.error;
+    free(ps.nodes);
+    free(ps.sets);
+    return a;
+}
+
+void automatonFree(struct automaton *a) {
+    if (a == NULL) return;
+    dfaFree(&a->search);
+    dfaFree(&a->anchored);
+    dfaFree(&a->reverse);
+    free(a->starts.bits);
+    free(a->forward.states);
+    free(a->backward.states);
+    free(a->sets);
+    free(a);
+}
+
+long automatonFindLine(struct automaton *a, const char *text, size_t len, size_t from) {
+    struct dfa *d = &a->search;
+    int s = dfaStart(d, 1);
+    int matched;
+    size_t lineStart = from;
+
+    for (size_t i = from; i < len; i++) {
+        unsigned char c = text[i];
+        s = dfaStep(d, s, c, &matched);
+        if (matched) return lineStart;
+        if (c == '\n') lineStart = i + 1;
+    }
+    // text ending in '\n' has no line after it to match an empty pattern
+    if (len == from || text[len - 1] != '\n') {
+        dfaStep(d, s, SYM_END, &matched);
+        if (matched) return lineStart;
+    }
+    return -1;
+}
+
+// runs the reverse DFA from the end of the line down to `from`, picking up
+// where the last call on the same line left off
+static void lineStartsScan(struct automaton *a, const char *line, size_t len, size_t from) {
+    struct lineStarts *ls = &a->starts;
+    if (from == 0 || line != ls->line || len != ls->len) {
+        size_t words = len / 64 + 1;
+        if (words > ls->cap) {
+            free(ls->bits);
+            ls->bits = malloc(sizeof(uint64_t) * words);
+            if (ls->bits == NULL) abort();
+            ls->cap = words;
+        }
+        memset(ls->bits, 0, sizeof(uint64_t) * words);
+        ls->line = line;
+        ls->len = len;
+        ls->low = len + 1;
+        ls->state = dfaStart(&a->reverse, 1);
+    }
+
+    int matched;
+    while (ls->low > from) {
+        size_t p = --ls->low;
+        int c = (p > 0) ? (unsigned char)line[p - 1] : SYM_END;
+        ls->state = dfaStep(&a->reverse, ls->state, c, &matched);
+        if (matched) ls->bits[p / 64] |= (uint64_t)1 << (p % 64);
+    }
+}
+
+// the first offset in [from, len] where a match starts, len if none
+static size_t lineStartsNext(const struct lineStarts *ls, size_t from) {
+    for (size_t p = from; p <= ls->len; p++) {
+        if (ls->bits[p / 64] >> (p % 64) & 1) return p;
+    }
+    return ls->len;
+}
+
+/* Three passes: the searching DFA checks there is a match at all, the
+ * reverse DFA run from the end of the line finds where the leftmost match
+ * starts, and the anchored DFA finds its longest end. Calls for the rest
+ * of a line, with from moved past the last match, share one reverse pass,
+ * so finding every match in a line stays linear; a call with from 0 starts
+ * a new one, since the text at the same address may have changed. */
+int automatonMatchLine(struct automaton *a, const char *line, size_t len, size_t from,
+                       size_t *start, size_t *end) {
+    int matched = 0;
+    int s = dfaStart(&a->search, from == 0);
+    for (size_t i = from; ; i++) {
+        int c = (i < len) ? (unsigned char)line[i] : SYM_END;
+        s = dfaStep(&a->search, s, c, &matched);
+        if (matched || i == len) break;
+    }
+    if (!matched) return 0;
+
+    lineStartsScan(a, line, len, from);
+    size_t first = lineStartsNext(&a->starts, from);
+
+    size_t last = first;
+    s = dfaStart(&a->anchored, first == 0);
+    for (size_t i = first; ; i++) {
+        int c = (i < len) ? (unsigned char)line[i] : SYM_END;
+        s = dfaStep(&a->anchored, s, c, &matched);
+        if (matched) last = i;
+        if (i == len || dfaDead(&a->anchored, s)) break;
+    }
+
+    *start = first;
+    *end = last;
+    return 1;
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/keywords.h"
+
+/*** character classes ***/
+
+// isspace, '\0' and ",.()+-/*=~%<>[];" are separators
+const unsigned char charClass[256] = {
+    ['\0'] = CC_SEPARATOR,
+    [' '] = CC_SEPARATOR, ['\t'] = CC_SEPARATOR, ['\n'] = CC_SEPARATOR,
+    ['\v'] = CC_SEPARATOR, ['\f'] = CC_SEPARATOR, ['\r'] = CC_SEPARATOR,
+    [','] = CC_SEPARATOR, ['.'] = CC_SEPARATOR, ['('] = CC_SEPARATOR,
+    [')'] = CC_SEPARATOR, ['+'] = CC_SEPARATOR, ['-'] = CC_SEPARATOR,
+    ['/'] = CC_SEPARATOR, ['*'] = CC_SEPARATOR, ['='] = CC_SEPARATOR,
+    ['~'] = CC_SEPARATOR, ['%'] = CC_SEPARATOR, ['<'] = CC_SEPARATOR,
+    ['>'] = CC_SEPARATOR, ['['] = CC_SEPARATOR, [']'] = CC_SEPARATOR,
+    [';'] = CC_SEPARATOR,
+    ['0'] = CC_DIGIT, ['1'] = CC_DIGIT, ['2'] = CC_DIGIT, ['3'] = CC_DIGIT,
+    ['4'] = CC_DIGIT, ['5'] = CC_DIGIT, ['6'] = CC_DIGIT, ['7'] = CC_DIGIT,
+    ['8'] = CC_DIGIT, ['9'] = CC_DIGIT,
+};
+
+/*** keyword trie ***/
+
+static int trieAddNode(struct keywordTrie *trie) {
+    if (trie->nrNodes == trie->capNodes) {
+        trie->capNodes = trie->capNodes ? trie->capNodes * 2 : 64;
+        trie->next = realloc(trie->next, sizeof(int) * trie->capNodes * trie->alphabet);
+        trie->keyword = realloc(trie->keyword, sizeof(int) * trie->capNodes);
+        trie->type = realloc(trie->type, trie->capNodes);
+        if (!trie->next || !trie->keyword || !trie->type) abort();
+    }
+    int node = trie->nrNodes++;
+    memset(&trie->next[node * trie->alphabet], 0, sizeof(int) * trie->alphabet);
+    trie->keyword[node] = -1;
+    trie->type[node] = 0;
+    return node;
+}
+
+/* Keywords ending in '|' get class kw2, the rest kw1. If two keywords could
+ * both match at a position the one listed first wins, like the linear scan
+ * this replaces. */
+struct keywordTrie *keywordTrieBuild(char **keywords, unsigned char kw1, unsigned char kw2) {
+    struct keywordTrie *trie = calloc(1, sizeof(struct keywordTrie));
+    if (trie == NULL) abort();
+
+    for (int j = 0; keywords[j]; j++) {
+        for (const char *p = keywords[j]; *p; p++) {
+            unsigned char c = *p;
+            if (trie->map[c] == 0 && !(c == '|' && p[1] == '\0')) {
+                trie->map[c] = ++trie->alphabet;
+            }
+        }
+    }
+    if (trie->alphabet == 0) trie->alphabet = 1;
+    trieAddNode(trie);
+
+    for (int j = 0; keywords[j]; j++) {
+        int klen = strlen(keywords[j]);
+        int secondary = klen > 0 && keywords[j][klen - 1] == '|';
+        if (secondary) klen--;
+        if (klen == 0) continue;
+
+        int node = 0;
+        for (int i = 0; i < klen; i++) {
+            int slot = node * trie->alphabet + trie->map[(unsigned char)keywords[j][i]] - 1;
+            if (trie->next[slot] == 0) {
+                int child = trieAddNode(trie);
+                trie->next[slot] = child;
+            }
+            node = trie->next[slot];
+        }
+        if (trie->keyword[node] == -1) {
+            trie->keyword[node] = j;
+            trie->type[node] = secondary ? kw2 : kw1;
+        }
+    }
+    return trie;
+}
+
+void keywordTrieFree(struct keywordTrie *trie) {
+    if (trie == NULL) return;
+    free(trie->next);
+    free(trie->keyword);
+    free(trie->type);
+    free(trie);
+}
+
+int keywordTrieMatch(const struct keywordTrie *trie, const char *s, int len, unsigned char *type) {
+    int node = 0;
+    int best = -1;
+    int bestLen = 0;
+
+    for (int i = 0; ; i++) {
+        if (trie->keyword[node] != -1 && (i == len || isSeparatorByte(s[i]))) {
+            if (best == -1 || trie->keyword[node] < best) {
+                best = trie->keyword[node];
+                bestLen = i;
+                *type = trie->type[node];
+            }
+        }
+        if (i == len) break;
+
+        int c = trie->map[(unsigned char)s[i]];
+        if (c == 0) break;
+        node = trie->next[node * trie->alphabet + c - 1];
+        if (node == 0) break;
+    }
+    return bestLen;
+}
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/lineindex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINE_SCAN_X86 1
+#endif
+
+#define DELTA_OVERFLOW UINT32_MAX
+
+/*** storage ***/
+
+void lineIndexInit(struct lineIndex *idx) {
+    memset(idx, 0, sizeof(*idx));
+}
+
+void lineIndexFree(struct lineIndex *idx) {
+    free(idx->base);
+    free(idx->delta);
+    free(idx->overflow);
+    lineIndexInit(idx);
+}
+
+static void lineIndexGrow(struct lineIndex *idx) {
+    int cap = idx->cap ? idx->cap * 2 : 4096;
+    uint32_t *delta = realloc(idx->delta, sizeof(uint32_t) * cap);
+    uint64_t *base = realloc(idx->base, sizeof(uint64_t) * (cap / LINE_BLOCK));
+    if (delta == NULL || base == NULL) abort();
+    idx->delta = delta;
+    idx->base = base;
+    idx->cap = cap;
+}
+
+static inline void lineIndexPush(struct lineIndex *idx, size_t start) {
+    if (idx->nrStarts == idx->cap) lineIndexGrow(idx);
+
+    int line = idx->nrStarts++;
+    if (line % LINE_BLOCK == 0) {
+        idx->base[line / LINE_BLOCK] = start;
+        idx->delta[line] = 0;
+        return;
+    }
+
+    uint64_t delta = start - idx->base[line / LINE_BLOCK];
+    if (delta < DELTA_OVERFLOW) {
+        idx->delta[line] = (uint32_t)delta;
+        return;
+    }
+
+    // a multi-gigabyte line; kept as (line, start) pairs in line order
+    idx->overflow = realloc(idx->overflow, sizeof(uint64_t) * 2 * (idx->nrOverflow + 1));
+    if (idx->overflow == NULL) abort();
+    idx->overflow[2 * idx->nrOverflow] = line;
+    idx->overflow[2 * idx->nrOverflow + 1] = start;
+    idx->nrOverflow++;
+    idx->delta[line] = DELTA_OVERFLOW;
+}
+
+void lineIndexAdd(struct lineIndex *idx, size_t start) {
+    lineIndexPush(idx, start);
+}
+
+size_t lineIndexStart(const struct lineIndex *idx, int line) {
+    uint32_t delta = idx->delta[line];
+    if (delta != DELTA_OVERFLOW) {
+        return idx->base[line / LINE_BLOCK] + delta;
+    }
+
+    int lo = 0;
+    int hi = idx->nrOverflow - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (idx->overflow[2 * mid] < (uint64_t)line) {
+            lo = mid + 1;
+        }else {
+            hi = mid;
+        }
+    }
+    return idx->overflow[2 * lo + 1];
+}
+
+// the line containing `offset`, i.e. the last line starting at or before it
+int lineIndexLineAt(const struct lineIndex *idx, size_t offset) {
+    int lo = 0;
+    int hi = idx->nrStarts - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (lineIndexStart(idx, mid) <= offset) {
+            lo = mid;
+        }else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// the text of a line without its \n or \r\n ending
+const char *lineIndexLine(const struct lineIndex *idx, const char *data, size_t size,
+                          int line, size_t *len) {
+    size_t start = lineIndexStart(idx, line);
+    size_t end = (line + 1 < idx->nrStarts) ? lineIndexStart(idx, line + 1) : size;
+    if (end > start && data[end - 1] == '\n') end--;
+    while (idx->hasCR && end > start && data[end - 1] == '\r') end--;
+    *len = end - start;
+    return &data[start];
+}
+
+size_t lineIndexBytes(const struct lineIndex *idx) {
+    return sizeof(uint32_t) * idx->cap + sizeof(uint64_t) * (idx->cap / LINE_BLOCK)
+        + sizeof(uint64_t) * 2 * idx->nrOverflow;
+}
+
+/*** scanners ***/
+
+static void scanScalar(struct lineIndex *idx, const char *data, size_t from, size_t to, size_t size) {
+    const char *p = &data[from];
+    const char *stop = &data[to];
+    if (!idx->hasCR && memchr(p, '\r', stop - p)) idx->hasCR = 1;
+
+    while (p < stop && (p = memchr(p, '\n', stop - p)) != NULL) {
+        p++;
+        if ((size_t)(p - data) < size) lineIndexPush(idx, p - data);
+    }
+}
+
+// pushes a start after every set bit of a newline mask for data[at, at + 64)
+static inline void scanMask(struct lineIndex *idx, uint64_t mask, size_t at, size_t size) {
+    while (mask) {
+        size_t start = at + __builtin_ctzll(mask) + 1;
+        if (start < size) lineIndexPush(idx, start);
+        mask &= mask - 1;
+    }
+}
+
+#ifdef LINE_SCAN_X86
+
+__attribute__((target("sse2")))
+static void scanSse2(struct lineIndex *idx, const char *data, size_t from, size_t to, size_t size) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    __m128i crSeen = _mm_setzero_si128();
+
+    size_t i = from;
+    for (; i + 64 <= to; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&data[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&data[i + 16]);
+        __m128i c = _mm_loadu_si128((const __m128i *)&data[i + 32]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&data[i + 48]);
+
+        crSeen = _mm_or_si128(crSeen, _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, cr)),
+            _mm_or_si128(_mm_cmpeq_epi8(c, cr), _mm_cmpeq_epi8(d, cr))));
+
+        uint64_t mask = (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, nl))
+            | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, nl)) << 16
+            | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, nl)) << 32
+            | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(d, nl)) << 48;
+        scanMask(idx, mask, i, size);
+    }
+    if (_mm_movemask_epi8(crSeen)) idx->hasCR = 1;
+
+    scanScalar(idx, data, i, to, size);
+}
+
+__attribute__((target("avx2")))
+static void scanAvx2(struct lineIndex *idx, const char *data, size_t from, size_t to, size_t size) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    __m256i crSeen = _mm256_setzero_si256();
+
+    size_t i = from;
+    for (; i + 64 <= to; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&data[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&data[i + 32]);
+
+        crSeen = _mm256_or_si256(crSeen,
+            _mm256_or_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, cr)));
+
+        uint64_t mask = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl))
+            | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32;
+        scanMask(idx, mask, i, size);
+    }
+    if (!_mm256_testz_si256(crSeen, crSeen)) idx->hasCR = 1;
+
+    scanScalar(idx, data, i, to, size);
+}
+
+#endif
+
+typedef void (*scanFn)(struct lineIndex *, const char *, size_t, size_t, size_t);
+
+static scanFn scanImpl = NULL;
+static const char *scanName = "scalar";
+
+static int scannerSupported(enum lineScanner scanner) {
+    switch (scanner) {
+        case LINE_SCAN_SCALAR: return 1;
+#ifdef LINE_SCAN_X86
+        case LINE_SCAN_SSE2: return __builtin_cpu_supports("sse2");
+        case LINE_SCAN_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return 0;
+    }
+}
+
+// picks the scanner used by lineIndexScan; AUTO takes the widest one the
+// CPU supports. Returns -1 if the requested one isn't available.
+int lineIndexUseScanner(enum lineScanner scanner) {
+    if (scanner == LINE_SCAN_AUTO) {
+        if (scannerSupported(LINE_SCAN_AVX2)) {
+            scanner = LINE_SCAN_AVX2;
+        }else if (scannerSupported(LINE_SCAN_SSE2)) {
+            scanner = LINE_SCAN_SSE2;
+        }else {
+            scanner = LINE_SCAN_SCALAR;
+        }
+    }
+    if (!scannerSupported(scanner)) return -1;
+
+    switch (scanner) {
+#ifdef LINE_SCAN_X86
+        case LINE_SCAN_SSE2: scanImpl = scanSse2; scanName = "sse2"; break;
+        case LINE_SCAN_AVX2: scanImpl = scanAvx2; scanName = "avx2"; break;
+#endif
+        default: scanImpl = scanScalar; scanName = "scalar"; break;
+    }
+    return 0;
+}
+
+const char *lineIndexScannerName(void) {
+    if (scanImpl == NULL) lineIndexUseScanner(LINE_SCAN_AUTO);
+    return scanName;
+}
+
+void lineIndexScan(struct lineIndex *idx, const char *data, size_t from, size_t to, size_t size) {
+    if (scanImpl == NULL) lineIndexUseScanner(LINE_SCAN_AUTO);
+    scanImpl(idx, data, from, to, size);
+}
@@ -8,21 +8,64 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include "../include/automaton.h"
 #include "../include/editor.h"
+#include "../include/keywords.h"
+#include "../include/perf.h"
+#include "../include/rowtree.h"
+#include "../include/substring.h"
+#include "../include/undolog.h"
+#include "../include/utf8.h"
 
 /*** defines ***/
 
 struct editorConfig E = {0};
 //rest in editor.h(header)
 
+// files at least this big are mapped instead of read line by line
+#define MAP_MIN_SIZE (1 << 20)
+// bytes scanned for newlines per step while indexing a mapped file
+#define MAP_INDEX_SLICE (16 << 20)
+// lines above and below the screen a read-only buffer keeps materialized
+#define PAGER_WINDOW 512
+// seconds between looks for a followed file that isn't at its path
+#define FOLLOW_RETRY 1.0
+// marked rows checked synchronously before a row is drawn
+#define HL_CATCHUP 4096
+// marked rows checked per step of the background highlighting pass
+#define HL_BACKGROUND_SLICE 2048
+// fewest rows in a chunk of the parallel highlighter, and chunks per
+// thread so one that finishes early can take another
+#define HL_CHUNK_MIN 1024
+#define HL_CHUNKS_PER_THREAD 4
+#define HL_MAX_THREADS 64
+// ms to wait for the rest of an escape sequence or of a paste
+#define INPUT_TIMEOUT 100
+// seconds a status message stays up
+#define STATUS_MSG_TIMEOUT 5
+
+enum editorTimers {
+    TIMER_STATUS_MSG = 0,
+    TIMER_SAVE_PROGRESS,
+    TIMER_FOLLOW,
+    NR_TIMERS
+};
+
 /*** data ***/
 
 /*** filetypes ***/
@@ -41,7 +84,8 @@ struct editorSyntax HLDB[] = {
       C_HL_extensions,
       C_HL_keywords,
       "//", "/*", "*/",
-      HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+      HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+      NULL
   },
 };
 
@@ -52,6 +96,16 @@ struct editorSyntax HLDB[] = {
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt, void(*callback)(char *, int));
+static int editorSaveShares(erow *row);
+static void editorSaveRetire(char *chars, int cap);
+static void editorUndoRecord(int type, int row, int at, const char *text, int len);
+static void editorWaitForInput(void);
+void editorWake(void);
+static void editorTimerArm(int timer, double delay);
+static void editorInputEnded(void);
+static void editorRowReserveHl(erow *row, int nrHl);
+static void editorFollowSaved(struct editorBuffer *buf);
+static void editorFollowDetach(void);
 
 /*** terminal ***/
 
@@ -64,6 +118,7 @@ void die(const char *s) {
 }
 
 void disableRawMode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
         die("tcsetattr");
     }
@@ -82,40 +137,131 @@ void enableRawMode() {
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 
+    // reads never block; editorWaitForInput polls for input instead
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
         die("tcgetattr");
     }
+    // pasted text arrives between ESC [ 200 ~ and ESC [ 201 ~
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int editorReadKey() {
-    int nread;
-    char c;
+/* Keys are parsed out of a buffer filled with one read at a time, so a
+ * burst of input costs one syscall rather than one per byte. */
+static struct {
+    char buf[4096];
+    int start;
+    int len;
+    int eof;
+} In;
+
+// reads whatever is available, waiting at most timeout ms for it to come;
+// returns bytes added
+static int editorInputFill(int timeout) {
+    if (In.start > 0) {
+        memmove(In.buf, &In.buf[In.start], In.len);
+        In.start = 0;
+    }
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout) <= 0) return 0;
+
+    int nread = read(STDIN_FILENO, &In.buf[In.len], sizeof(In.buf) - In.len);
+    if (nread == -1 && errno != EAGAIN) {
+        die("read");
+    }
+    // readable but empty: the end of a key file, or a terminal hanging up
+    if (nread == 0) In.eof = 1;
+    if (nread <= 0) return 0;
+    In.len += nread;
+    return nread;
+}
+
+// the next input byte, reading more if the buffer is empty; 0 if none came
+// within INPUT_TIMEOUT, as after a lone ESC
+static int editorInputByte(char *c) {
+    if (In.len == 0 && editorInputFill(INPUT_TIMEOUT) == 0) return 0;
+    *c = In.buf[In.start++];
+    In.len--;
+    return 1;
+}
+
+static int editorInputBuffered(void) {
+    return In.len > 0;
+}
 
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) {
-            die("read");
+/* Reads the text of a bracketed paste up to its closing ESC [ 201 ~ and
+ * returns it, *len bytes, in a malloc'd buffer. */
+static char *editorReadPaste(size_t *len) {
+    static const char endMark[] = "\x1b[201~";
+    size_t markLen = sizeof(endMark) - 1;
+    size_t cap = 4096;
+    size_t size = 0;
+    char *text = malloc(cap);
+    if (text == NULL) die("malloc");
+
+    int stalled = 0;
+    while (1) {
+        const char *from = &In.buf[In.start];
+        const char *end = memmem(from, In.len, endMark, markLen);
+        // the tail could be the start of a cut off end mark, unless the
+        // terminal stopped sending without closing the paste
+        size_t keep = 0;
+        if (!stalled) keep = ((size_t)In.len < markLen - 1) ? (size_t)In.len : markLen - 1;
+        size_t take = end ? (size_t)(end - from) : In.len - keep;
+
+        if (size + take > cap) {
+            while (size + take > cap) cap *= 2;
+            text = realloc(text, cap);
+            if (text == NULL) die("realloc");
+        }
+        memcpy(&text[size], from, take);
+        size += take;
+        In.start += take;
+        In.len -= take;
+
+        if (end) {
+            In.start += markLen;
+            In.len -= markLen;
+            break;
         }
+        if (stalled) break;
+        stalled = (editorInputFill(INPUT_TIMEOUT) == 0);
     }
+    *len = size;
+    return text;
+}
+
+// only called with input buffered, so the first byte is always there
+static int editorDecodeKey(void) {
+    char c;
+
+    if (!editorInputByte(&c)) return '\x1b';
     if (c == '\x1b') {
-        char seq[3];
+        char seq[2];
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if (!editorInputByte(&seq[0])) return '\x1b';
+        if (!editorInputByte(&seq[1])) return '\x1b';
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DELETE_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                int code = seq[1] - '0';
+                char next;
+                while (1) {
+                    if (!editorInputByte(&next)) return '\x1b';
+                    if (next < '0' || next > '9') break;
+                    code = code * 10 + next - '0';
+                }
+                if (next == '~') {
+                    switch (code) {
+                        case 1: return HOME_KEY;
+                        case 3: return DELETE_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200: return PASTE_START;
                     }
                 }
             }else {
@@ -136,8 +282,18 @@ int editorReadKey() {
         }
         return '\x1b';
     }else {
-        return c;
+        return (unsigned char)c;
+    }
+}
+
+int editorReadKey() {
+    while (!editorInputBuffered()) {
+        editorWaitForInput();
     }
+    perfPush(PERF_INPUT);
+    int key = editorDecodeKey();
+    perfPop();
+    return key;
 }
 
 int getCursorPosition(int *rows, int *cols) {
@@ -148,7 +304,7 @@ int getCursorPosition(int *rows, int *cols) {
 
     char c;
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+        if (!editorInputByte(&buf[i])) break;
         if (buf[i] == 'R') break;
         i++;
     }
@@ -178,22 +334,116 @@ int getWindowSize(int *rows, int *cols) {
 /*** syntax highlighting ***/
 
 int isSeparator(char c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+    return isSeparatorByte(c);
 }
 
-void editorUpdateSyntax(erow *row) {
-    row->highlight = realloc(row->highlight, row->rsize);
-    memset(row->highlight, HL_NORMAL, row->rsize);
+/* Rows keep their highlighting as spans (see struct hlSpan). It is worked
+ * out a byte per render byte in a scratch buffer shared by all rows, then
+ * encoded into spans. Both scratch buffers belong to the main thread. */
+static unsigned char *hlScratch;
+static int hlScratchCap;
+static struct hlSpan *hlSpanScratch;
+static int hlSpanScratchCap;
+
+static unsigned char *editorHlScratch(int size) {
+    if (size > hlScratchCap) {
+        hlScratchCap = hlScratchCap ? hlScratchCap : 256;
+        while (hlScratchCap < size) hlScratchCap *= 2;
+        hlScratch = realloc(hlScratch, hlScratchCap);
+        if (hlScratch == NULL) die("realloc");
+    }
+    return hlScratch;
+}
 
-    if (E.syntax == NULL) {
-        return;
+// length of the run of `value` bytes at the start of hl[0, len), compared
+// eight at a time
+static int editorHlRun(const unsigned char *hl, int len, unsigned char value) {
+    uint64_t fill = 0x0101010101010101ull * value;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, &hl[i], 8);
+        if (word != fill) break;
+    }
+    while (i < len && hl[i] == value) i++;
+    return i;
+}
+
+// writes the runs in hl[0, len) to spans, which has room for len of them,
+// and returns how many there are
+static int editorHlSpans(const unsigned char *hl, int len, struct hlSpan *spans) {
+    int n = 0;
+    int i = editorHlRun(hl, len, HL_NORMAL);
+    while (i < len) {
+        int start = i;
+        int limit = len - start < HL_SPAN_MAX ? len - start : HL_SPAN_MAX;
+        i += editorHlRun(&hl[start], limit, hl[start]);
+        spans[n++] = (struct hlSpan){ start, i - start, hl[start] };
+        i += editorHlRun(&hl[i], len - i, HL_NORMAL);
+    }
+    return n;
+}
+
+static void editorRowSetHl(erow *row, const struct hlSpan *spans, int n) {
+    editorRowReserveHl(row, n);
+    if (n > 0) memcpy(row->hl, spans, sizeof(struct hlSpan) * n);
+    row->nrHl = n;
+}
+
+// replaces the row's spans with the runs in hl[0, rsize)
+static void editorHlEncode(erow *row, const unsigned char *hl) {
+    if (row->rsize > hlSpanScratchCap) {
+        hlSpanScratchCap = hlSpanScratchCap ? hlSpanScratchCap : 256;
+        while (hlSpanScratchCap < row->rsize) hlSpanScratchCap *= 2;
+        hlSpanScratch = realloc(hlSpanScratch, sizeof(struct hlSpan) * hlSpanScratchCap);
+        if (hlSpanScratch == NULL) die("realloc");
+    }
+    editorRowSetHl(row, hlSpanScratch, editorHlSpans(hl, row->rsize, hlSpanScratch));
+}
+
+// fills hl[0, rsize) from the row's spans
+static void editorHlDecode(const erow *row, unsigned char *hl) {
+    memset(hl, HL_NORMAL, row->rsize);
+    for (int k = 0; k < row->nrHl; k++) {
+        memset(&hl[row->hl[k].start], row->hl[k].hl, row->hl[k].len);
+    }
+}
+
+// index of the first span that ends past render offset `at`
+static int editorRowHlFrom(const erow *row, int at) {
+    int lo = 0, hi = row->nrHl;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->hl[mid].start + (int)row->hl[mid].len <= at) {
+            lo = mid + 1;
+        }else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+unsigned char editorRowHighlightAt(const erow *row, int at) {
+    int k = editorRowHlFrom(row, at);
+    return (k < row->nrHl && row->hl[k].start <= at) ? row->hl[k].hl : HL_NORMAL;
+}
+
+/* Highlights render[from, rsize) of a row into hl, where `from` is 0 or follows a
+ * plain separator, starting in the given comment state; returns the state
+ * at the end of the row. With converge >= 0 it stops early, setting
+ * *converged, at the first plain separator at or past `converge` that was
+ * also plain before: from there on the old highlighting is still right. */
+static int editorHighlightRange(erow *row, unsigned char *hl, int from, int inComment, int converge, int *converged) {
+    if (E.buf->syntax == NULL) {
+        memset(&hl[from], HL_NORMAL, row->rsize - from);
+        return 0;
     }
 
-    char **keywords = E.syntax->keywords;
+    const struct keywordTrie *keywords = E.buf->syntax->keywordTrie;
 
-    char *scs =  E.syntax->singelLineCommentStart;
-    char *mcs = E.syntax->multilineCommentStart;
-    char *mce = E.syntax->multilineCommentEnd;
+    char *scs =  E.buf->syntax->singelLineCommentStart;
+    char *mcs = E.buf->syntax->multilineCommentStart;
+    char *mce = E.buf->syntax->multilineCommentEnd;
 
 
     int scsLen = scs ? strlen(scs) : 0;
@@ -202,43 +452,43 @@ void editorUpdateSyntax(erow *row) {
 
     int prevSep = 1;
     int inString = 0;
-    int inComment = (row->index > 0 && E.row[row->index - 1].hlOpenComment);
 
-    int i = 0;
+    int i = from;
     while (i < row->rsize) {
         char c = row->render[i];
-        unsigned char prevHl =  (i > 0) ? row->highlight[i-1] : HL_NORMAL;
+        unsigned char prevHl =  (i > 0) ? hl[i-1] : HL_NORMAL;
+        unsigned char before = hl[i];
 
         if (scsLen && !inString && !inComment) {
-            if (!strncmp(&row->render[i], scs, scsLen)) {
-                memset(&row->highlight[i], HL_COMMENT, row->rsize - i);
+            if (c == scs[0] && !strncmp(&row->render[i], scs, scsLen)) {
+                memset(&hl[i], HL_COMMENT, row->rsize - i);
                 break;
             }
         }
 
         if (mcsLen && mceLen && !inString) {
             if (inComment) {
-                row->highlight[i] = HL_COMMENT;
-                if (!strncmp(&row->render[i], mce, mceLen)) {
-                    memset(&row->highlight[i], HL_COMMENT, mceLen);
+                hl[i] = HL_COMMENT;
+                if (c == mce[0] && !strncmp(&row->render[i], mce, mceLen)) {
+                    memset(&hl[i], HL_COMMENT, mceLen);
                     i += mceLen;
                     inComment = 0;
                     prevSep = 1;
                     continue;
                 }
-            }else if (!strncmp(&row->render[i], mcs, mcsLen)) {
-                memset(&row->highlight[i], HL_COMMENT, mcsLen);
+            }else if (c == mcs[0] && !strncmp(&row->render[i], mcs, mcsLen)) {
+                memset(&hl[i], HL_COMMENT, mcsLen);
                 i += mcsLen;
                 inComment = 1;
                 continue;
             }
         }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+        if (E.buf->syntax->flags & HL_HIGHLIGHT_STRINGS) {
             if (inString) {
-                row->highlight[i] = HL_STRING;
+                hl[i] = HL_STRING;
                 if (c == '\\' && i+1 < row->rsize) {
-                    row->highlight[i+1] = HL_STRING;
+                    hl[i+1] = HL_STRING;
                     i += 2;
                     continue;
                 }
@@ -249,16 +499,16 @@ void editorUpdateSyntax(erow *row) {
             }else {
                 if (c == '"' || c == '\'') {
                     inString = c;
-                    row->highlight[i] = HL_STRING;
+                    hl[i] = HL_STRING;
                     i++;
                     continue;
                 }
             }
         }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if ((isdigit(c) && (prevSep || prevHl == HL_NUMBER)) || (c == '.' && prevHl == HL_NUMBER)) {
-                row->highlight[i] = HL_NUMBER;
+        if (E.buf->syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            if (((charClass[(unsigned char)c] & CC_DIGIT) && (prevSep || prevHl == HL_NUMBER)) || (c == '.' && prevHl == HL_NUMBER)) {
+                hl[i] = HL_NUMBER;
                 i++;
                 prevSep = 0;
                 continue;
@@ -266,34 +516,152 @@ void editorUpdateSyntax(erow *row) {
         }
 
         if (prevSep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][ klen - 1 ] == '|';
-                if (kw2) klen--;
-
-                if (!strncmp(&row->render[i], keywords[j], klen) && isSeparator(row->render[i + klen])) {
-                    memset(&row->highlight[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL) {
+            unsigned char type;
+            int klen = keywordTrieMatch(keywords, &row->render[i], row->rsize - i, &type);
+            if (klen) {
+                memset(&hl[i], type, klen);
+                i += klen;
                 prevSep = 0;
                 continue;
             }
         }
 
         prevSep = isSeparator(c);
+        if (!inComment) {
+            hl[i] = HL_NORMAL;
+            if (converge >= 0 && i >= converge && prevSep && before == HL_NORMAL) {
+                *converged = 1;
+                break;
+            }
+        }
         i++;
     }
+    return inComment;
+}
+
+static int editorHighlightRow(erow *row, unsigned char *hl, int inComment) {
+    return editorHighlightRange(row, hl, 0, inComment, -1, NULL);
+}
+
+// the comment state a row starts in, as last computed for the row above
+static int editorSyntaxEntry(rowNode *node) {
+    rowNode *prev = rowTreePrev(node);
+    return (prev && prev->span == 0) ? prev->row.hlOpenComment : 0;
+}
+
+/* Re-highlights a row from the state the row above ended in. If the row now
+ * ends in a different state the row below is only marked, not re-highlighted:
+ * the change travels further down as marked rows are checked. */
+void editorUpdateSyntax(erow *row) {
+    perfPush(PERF_SYNTAX);
+    rowNode *node = (rowNode *)row;
+    int entry = editorSyntaxEntry(node);
+
+    unsigned char *hl = editorHlScratch(row->rsize);
+    int inComment = editorHighlightRow(row, hl, entry);
+    editorHlEncode(row, hl);
+    row->hlEntryComment = entry;
+    row->hlDirty = 0;
+
     int changed = (row->hlOpenComment != inComment);
     row->hlOpenComment = inComment;
-    if (changed && row->index + 1 < E.nrRows) {
-        editorUpdateSyntax(&E.row[row->index + 1]);
+    rowNode *next = rowTreeNext(node);
+    if (changed && next && next->span == 0) {
+        rowTreeSetMark(next, 1);
+    }
+    perfPop();
+}
+
+/* Re-highlights a row after render[from, converge) was rewritten and the
+ * rest shifted into place, hl holding the old highlighting moved along
+ * with it, starting at the last plain separator that no comment delimiter
+ * starting there could reach past `from`. A row that is already waiting to
+ * be highlighted is left to editorSyntaxEnsure. */
+static void editorSyntaxPatch(erow *row, unsigned char *hl, int from, int converge) {
+    rowNode *node = (rowNode *)row;
+    if (row->hlDirty || row->hlEntryComment != editorSyntaxEntry(node)) {
+        row->hlDirty = 1;
+        rowTreeSetMark(node, 1);
+        return;
+    }
+    // without a syntax there are no spans to move
+    if (E.buf->syntax == NULL) return;
+
+    // how far a comment delimiter starting before `from` could reach into it
+    int reach = 1;
+    char *scs = E.buf->syntax->singelLineCommentStart;
+    char *mcs = E.buf->syntax->multilineCommentStart;
+    if (scs && (int)strlen(scs) > reach) reach = strlen(scs);
+    if (mcs && (int)strlen(mcs) > reach) reach = strlen(mcs);
+
+    int start = from - reach + 1;
+    while (start > 0 && !(hl[start - 1] == HL_NORMAL && isSeparator(row->render[start - 1]))) {
+        start--;
+    }
+    if (start < 0) start = 0;
+
+    int converged = 0;
+    int inComment = editorHighlightRange(row, hl, start, start ? 0 : row->hlEntryComment, converge, &converged);
+    editorHlEncode(row, hl);
+    if (converged || inComment == row->hlOpenComment) return;
+
+    row->hlOpenComment = inComment;
+    rowNode *next = rowTreeNext(node);
+    if (next && next->span == 0) {
+        rowTreeSetMark(next, 1);
+    }
+}
+
+// re-highlights a marked row if its text or entry state changed
+static void editorSyntaxCheck(rowNode *node) {
+    rowTreeSetMark(node, 0);
+    erow *row = &node->row;
+    if (row->hlDirty || row->hlEntryComment != editorSyntaxEntry(node)) {
+        editorUpdateSyntax(row);
+    }
+}
+
+/* Makes a row's highlighting current before it is drawn. Every marked row
+ * above it is checked first, top down, which stops as soon as the states
+ * line up again. If that would mean checking more than HL_CATCHUP rows (a
+ * jump into a file that hasn't been highlighted yet) the row is highlighted
+ * from the row above as it stands and the background pass corrects it. */
+void editorSyntaxEnsure(erow *row) {
+    rowNode *node = (rowNode *)row;
+
+    if (E.buf->syntax == NULL) {
+        if (row->hlDirty) editorUpdateSyntax(row);
+        rowTreeSetMark(node, 0);
+        return;
+    }
+
+    rowNode *first;
+    int target = -1;
+    while ((first = rowTreeFirstMarked(&E.buf->rows)) != NULL) {
+        if (target == -1) target = editorRowIndex(row);
+        int at = rowTreeIndexOf(first);
+        if (at > target) break;
+        if (target - at > HL_CATCHUP) {
+            if (row->hlDirty || row->hlEntryComment != editorSyntaxEntry(node)) {
+                editorUpdateSyntax(row);
+            }
+            return;
+        }
+        editorSyntaxCheck(first);
     }
 }
 
+// checks up to `budget` marked rows from the top; returns 1 if any are left
+int editorSyntaxBackground(int budget) {
+    if (E.buf->syntax == NULL) return 0;
+
+    rowNode *node;
+    while (budget-- > 0 && (node = rowTreeFirstMarked(&E.buf->rows)) != NULL) {
+        editorSyntaxCheck(node);
+    }
+    return rowTreeFirstMarked(&E.buf->rows) != NULL;
+}
+
 int editorSyntaxToColor(int hl) {
     switch (hl) {
         case HL_COMMENT:
@@ -308,12 +676,12 @@ int editorSyntaxToColor(int hl) {
 }
 
 void editorSelectSyntaxHighlight() {
-    E.syntax = NULL;
-    if (E.filename == NULL) {
+    E.buf->syntax = NULL;
+    if (E.buf->filename == NULL) {
         return;
     }
 
-    char *ext = strchr(E.filename, '.');
+    char *ext = strchr(E.buf->filename, '.');
 
     for (unsigned int j = 0; j < HLBD_ENTRIES; j++) {
         struct editorSyntax *s = &HLDB[j];
@@ -321,12 +689,17 @@ void editorSelectSyntaxHighlight() {
         while (s-> fileMatch[i]) {
             int is_ext = (s->fileMatch[i][0] == '.');
             if ((is_ext && ext && !strcmp(ext, s->fileMatch[i])) || (!is_ext && ext && ext && strcmp(ext, s->fileMatch[i]))) {
-                E.syntax = s;
+                E.buf->syntax = s;
+                // compiled once, the first time a file of this type is opened
+                if (s->keywordTrie == NULL) {
+                    s->keywordTrie = keywordTrieBuild(s->keywords, HL_KEYWORD1, HL_KEYWORD2);
+                }
 
-                int filerow;
-                for (filerow = 0; filerow < E.nrRows; filerow++) {
-                    editorUpdateSyntax(&E.row[filerow]);
+                rowNode *node;
+                for (node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+                    node->row.hlDirty = 1;
                 }
+                rowTreeMarkAll(&E.buf->rows);
 
                 return;
             }
@@ -335,34 +708,410 @@ void editorSelectSyntaxHighlight() {
     }
 }
 
+/*** parallel highlighting ***/
+
+/* A run of rows lexed on a worker as if the row above them ended outside
+ * a comment. Workers never touch the row heap, so the spans of all the
+ * chunk's rows go into one array of its own, to be copied into the rows
+ * on the main thread. */
+struct hlChunk {
+    erow **rows;
+    int count;
+    unsigned char *hl;
+    int hlCap;
+    struct hlSpan *spans;
+    size_t nrSpans;
+    size_t capSpans;
+    size_t *spanAt;
+    unsigned char *exit;
+};
+
+static struct {
+    struct hlChunk *chunks;
+    int nrChunks;
+    int next;
+    pthread_mutex_t lock;
+} H = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void editorHlChunkLex(struct hlChunk *chunk) {
+    int inComment = 0;
+    for (int i = 0; i < chunk->count; i++) {
+        erow *row = chunk->rows[i];
+        if (row->rsize > chunk->hlCap) {
+            chunk->hlCap = row->rsize * 2;
+            chunk->hl = realloc(chunk->hl, chunk->hlCap);
+            if (chunk->hl == NULL) die("realloc");
+        }
+        if (chunk->nrSpans + row->rsize > chunk->capSpans) {
+            chunk->capSpans = (chunk->nrSpans + row->rsize) * 2;
+            chunk->spans = realloc(chunk->spans, sizeof(struct hlSpan) * chunk->capSpans);
+            if (chunk->spans == NULL) die("realloc");
+        }
+        inComment = editorHighlightRow(row, chunk->hl, inComment);
+        chunk->spanAt[i] = chunk->nrSpans;
+        chunk->nrSpans += editorHlSpans(chunk->hl, row->rsize, &chunk->spans[chunk->nrSpans]);
+        chunk->exit[i] = inComment;
+    }
+    chunk->spanAt[chunk->count] = chunk->nrSpans;
+}
+
+static void *editorHlWorker(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&H.lock);
+        int c = H.next++;
+        pthread_mutex_unlock(&H.lock);
+        if (c >= H.nrChunks) return NULL;
+        editorHlChunkLex(&H.chunks[c]);
+    }
+}
+
+// highlights a row on this thread, leaving its mark to the caller
+static int editorHlRowSerial(erow *row, int inComment) {
+    unsigned char *hl = editorHlScratch(row->rsize);
+    row->hlEntryComment = inComment;
+    inComment = editorHighlightRow(row, hl, inComment);
+    editorHlEncode(row, hl);
+    row->hlOpenComment = inComment;
+    row->hlDirty = 0;
+    return inComment;
+}
+
+// takes a chunk's results in order, re-lexing its first rows on this thread
+// while the state they really start in isn't the one they were lexed from
+static int editorHlChunkJoin(struct hlChunk *chunk, int inComment) {
+    int fixing = (inComment != 0);
+    for (int i = 0; i < chunk->count; i++) {
+        erow *row = chunk->rows[i];
+        if (fixing) {
+            inComment = editorHlRowSerial(row, inComment);
+            fixing = (inComment != chunk->exit[i]);
+            continue;
+        }
+        editorRowSetHl(row, &chunk->spans[chunk->spanAt[i]], chunk->spanAt[i + 1] - chunk->spanAt[i]);
+        row->hlEntryComment = inComment;
+        inComment = chunk->exit[i];
+        row->hlOpenComment = inComment;
+        row->hlDirty = 0;
+    }
+    return inComment;
+}
+
+// lexes nrChunks chunks of rows on up to `threads` threads, then joins them
+static void editorHlParallel(erow **rows, int count, int threads, int nrChunks) {
+    H.chunks = calloc(nrChunks, sizeof(struct hlChunk));
+    if (H.chunks == NULL) die("calloc");
+    for (int c = 0; c < nrChunks; c++) {
+        struct hlChunk *chunk = &H.chunks[c];
+        int first = (long)count * c / nrChunks;
+        chunk->rows = &rows[first];
+        chunk->count = (long)count * (c + 1) / nrChunks - first;
+        chunk->spanAt = malloc(sizeof(size_t) * (chunk->count + 1));
+        chunk->exit = malloc(chunk->count);
+        if (chunk->spanAt == NULL || chunk->exit == NULL) die("malloc");
+    }
+    H.nrChunks = nrChunks;
+    H.next = 0;
+
+    // this thread takes chunks too; it does them all if no worker starts
+    pthread_t workers[HL_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, editorHlWorker, NULL) == 0) {
+        started++;
+    }
+    editorHlWorker(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    int inComment = 0;
+    for (int c = 0; c < nrChunks; c++) {
+        struct hlChunk *chunk = &H.chunks[c];
+        inComment = editorHlChunkJoin(chunk, inComment);
+        free(chunk->hl);
+        free(chunk->spans);
+        free(chunk->spanAt);
+        free(chunk->exit);
+    }
+    free(H.chunks);
+    H.chunks = NULL;
+    H.nrChunks = 0;
+}
+
+/* Highlights the whole buffer at once, materializing every row of a mapped
+ * file first. The rows are cut into chunks that `threads` workers (one per
+ * core if 0) lex independently, each chunk from outside a comment. The
+ * chunks are then joined top down: where a chunk really starts inside a
+ * comment its rows are lexed again until one ends in the state the worker
+ * had it end in, and the worker's results stand from there. */
+void editorSyntaxAll(int threads) {
+    if (E.buf->syntax == NULL) return;
+    perfPush(PERF_SYNTAX);
+
+    editorMapFinishIndex();
+    erow **rows = malloc(sizeof(erow *) * (E.buf->nrRows + 1));
+    if (rows == NULL) die("malloc");
+    int count = 0;
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row)) {
+        rows[count++] = row;
+    }
+
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > HL_MAX_THREADS) threads = HL_MAX_THREADS;
+    int nrChunks = threads * HL_CHUNKS_PER_THREAD;
+    if (nrChunks > count / HL_CHUNK_MIN) nrChunks = count / HL_CHUNK_MIN;
+
+    // with no marks left every row is highlighted already
+    if (rowTreeFirstMarked(&E.buf->rows) != NULL) {
+        if (threads <= 1 || nrChunks < 2) {
+            // with nothing to run alongside, a chunk isn't worth its copy
+            int inComment = 0;
+            for (int i = 0; i < count; i++) {
+                inComment = editorHlRowSerial(rows[i], inComment);
+            }
+        }else {
+            editorHlParallel(rows, count, threads < nrChunks ? threads : nrChunks, nrChunks);
+        }
+        rowTreeClearMarks(&E.buf->rows);
+    }
+    free(rows);
+    perfPop();
+}
+
 /*** row operations ***/
 
+void editorMapLine(int line, char **chars, int *len);
+
+// makes `at` the first line of its node by cutting a span in two
+static void editorSplitSpan(int at) {
+    int offset;
+    rowNode *node = rowTreeAt(&E.buf->rows, at, &offset);
+    if (node == NULL || node->span == 0 || offset == 0) return;
+
+    rowNode *tail = rowTreeNewNode();
+    if (tail == NULL) die("malloc");
+    tail->span = node->span - offset;
+    tail->mapLine = node->mapLine + offset;
+    rowTreeResize(node, offset);
+    rowTreeInsert(&E.buf->rows, at, tail);
+}
+
+// turns the mapped line at `at` into a real row whose chars still point into
+// the mapping; editing it copies them to the heap (editorRowPromote)
+static erow *editorMaterializeRow(int at) {
+    editorSplitSpan(at);
+    editorSplitSpan(at + 1);
+
+    rowNode *node = rowTreeAt(&E.buf->rows, at, NULL);
+    if (node == NULL) return NULL;
+
+    erow *row = &node->row;
+    if (node->span) {
+        editorMapLine(node->mapLine, &row->chars, &row->size);
+        row->charsMapped = 1;
+        row->charsCap = 0;
+        row->rsize = 0;
+        row->renderCap = 0;
+        row->render = NULL;
+        row->renderCols = NULL;
+        row->tabs = NULL;
+        row->nrTabs = 0;
+        row->tabsCap = 0;
+        row->hl = NULL;
+        row->nrHl = 0;
+        row->hlCap = 0;
+        row->hlOpenComment = 0;
+        node->span = 0;
+        editorUpdateRow(row);
+    }
+    return row;
+}
+
+erow *editorRowAt(int at) {
+    rowNode *node = rowTreeAt(&E.buf->rows, at, NULL);
+    if (node == NULL) return NULL;
+    if (node->span) return editorMaterializeRow(at);
+    return &node->row;
+}
+
+erow *editorRowNext(erow *row) {
+    rowNode *node = rowTreeNext((rowNode *)row);
+    if (node == NULL) return NULL;
+    if (node->span) return editorMaterializeRow(editorRowIndex(row) + 1);
+    return &node->row;
+}
+
+erow *editorRowPrev(erow *row) {
+    rowNode *node = rowTreePrev((rowNode *)row);
+    if (node == NULL) return NULL;
+    if (node->span) return editorMaterializeRow(editorRowIndex(row) - 1);
+    return &node->row;
+}
+
+int editorRowIndex(erow *row) {
+    return rowTreeIndexOf((rowNode *)row);
+}
+
+/* Column conversions go through the row's tab index: between two tabs
+ * every byte of chars is one byte of render, so the render offset of any
+ * cx is the end of the last tab before it plus the distance from that tab.
+ * Columns are render offsets in an ASCII row and renderCols otherwise. */
+
+// index of the first tab at or after chars[cx]
+static int editorRowTabAfter(erow *row, int cx) {
+    int lo = 0, hi = row->nrTabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].at < cx) {
+            lo = mid + 1;
+        }else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int editorRowCxToRender(erow *row, int cursorX) {
+    int k = editorRowTabAfter(row, cursorX);
+    if (k == 0) return cursorX;
+    struct rowTab *tab = &row->tabs[k - 1];
+    return tab->end + (cursorX - tab->at - 1);
+}
+
+// the chars offset render[at] came from; the spaces of a tab give the tab
+static int editorRowRenderToCx(erow *row, int at) {
+    int lo = 0, hi = row->nrTabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].end <= at) {
+            lo = mid + 1;
+        }else {
+            hi = mid;
+        }
+    }
+    int cx = (lo == 0) ? at : row->tabs[lo - 1].at + 1 + (at - row->tabs[lo - 1].end);
+    if (lo < row->nrTabs && cx > row->tabs[lo].at) cx = row->tabs[lo].at;
+    return cx;
+}
+
 int editorRowCxToRx(erow *row, int cursorX) {
-    int rx = 0;
-    int j;
-    for (j = 0; j < cursorX; j++) {
-        if (row->chars[j] == '\t') {
-            rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+    int at = editorRowCxToRender(row, cursorX);
+    return row->renderCols ? row->renderCols[at] : at;
+}
+
+// first render byte drawn at or right of column rx
+static int editorRowRenderAtCol(erow *row, int rx) {
+    if (row->renderCols == NULL) return (rx < row->rsize) ? rx : row->rsize;
+    int lo = 0, hi = row->rsize;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->renderCols[mid] < rx) {
+            lo = mid + 1;
+        }else {
+            hi = mid;
         }
-        rx++;
     }
-    return rx;
+    return lo;
 }
 
+// the character covering column rx, or the end of the row past its last
 int editorRowRxToCx(erow *row, int rx) {
-    int curRx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t') {
-            curRx += (TAB_STOP - 1) - (curRx % TAB_STOP);
-        }
-        curRx++;
+    if (rx < 0) return 0;
+    int width = row->renderCols ? row->renderCols[row->rsize] : row->rsize;
+    if (rx >= width) return row->size;
+    // its last byte is the one right before the next column
+    int cx = editorRowRenderToCx(row, editorRowRenderAtCol(row, rx + 1) - 1);
+    return row->renderCols ? utf8CharStart(row, cx) : cx;
+}
+
+// a buffer that has to grow is doubled, so typing into a line is amortized
+static int editorGrowCap(int cap, int need) {
+    if (cap == 0) return need;
+    while (cap < need) cap *= 2;
+    return cap;
+}
+
+// makes room for `size` chars plus the terminator
+static void editorRowReserveChars(erow *row, int size) {
+    if (size + 1 <= row->charsCap) return;
+    int cap = rowAllocSize(editorGrowCap(row->charsCap, size + 1));
+    row->chars = rowRealloc(&E.buf->heap, ROW_CHARS, row->chars, row->charsCap, cap);
+    row->charsCap = cap;
+}
+
+// makes room for `rsize` render bytes plus the terminator; the column
+// map, if the row has one, grows along with them
+static void editorRowReserveRender(erow *row, int rsize) {
+    if (rsize + 1 <= row->renderCap) return;
+    int cap = rowAllocSize(editorGrowCap(row->renderCap, rsize + 1));
+    row->render = rowRealloc(&E.buf->heap, ROW_RENDER, row->render, row->renderCap, cap);
+    if (row->renderCols) {
+        row->renderCols = rowRealloc(&E.buf->heap, ROW_COLS, row->renderCols,
+                                     sizeof(int) * row->renderCap, sizeof(int) * cap);
+    }
+    row->renderCap = cap;
+}
+
+// makes room for `nrHl` highlight spans
+static void editorRowReserveHl(erow *row, int nrHl) {
+    if (nrHl <= row->hlCap) return;
+    int cap = rowAllocSize(sizeof(struct hlSpan) * editorGrowCap(row->hlCap, nrHl)) / sizeof(struct hlSpan);
+    row->hl = rowRealloc(&E.buf->heap, ROW_HL, row->hl,
+                         sizeof(struct hlSpan) * row->hlCap, sizeof(struct hlSpan) * cap);
+    row->hlCap = cap;
+}
+
+// makes room for `nrTabs` entries in the tab index
+static void editorRowReserveTabs(erow *row, int nrTabs) {
+    if (nrTabs <= row->tabsCap) return;
+    int cap = rowAllocSize(sizeof(struct rowTab) * editorGrowCap(row->tabsCap, nrTabs)) / sizeof(struct rowTab);
+    row->tabs = rowRealloc(&E.buf->heap, ROW_TABS, row->tabs,
+                           sizeof(struct rowTab) * row->tabsCap, sizeof(struct rowTab) * cap);
+    row->tabsCap = cap;
+}
+
+/* Renders a row with multibyte characters, whose render offsets are no
+ * longer columns: a wide character takes two columns for its three or four
+ * bytes and a combining mark none. Their columns go to renderCols. Runs of
+ * ASCII between them are found with utf8AsciiPrefix and copied a byte a
+ * column, like a plain row. */
+static void editorUpdateRowUtf8(erow *row, int tabs) {
+    editorRowReserveRender(row, row->size + tabs*(TAB_STOP - 1));
+    if (row->renderCols == NULL) {
+        row->renderCols = rowAlloc(&E.buf->heap, ROW_COLS, sizeof(int) * row->renderCap);
+    }
 
-        if (curRx == rx) {
-            return cx;
+    int index = 0;
+    int col = 0;
+    int j = 0;
+    while (j < row->size) {
+        int ascii = utf8AsciiPrefix(&row->chars[j], row->size - j);
+        for (int end = j + ascii; j < end; j++) {
+            if (row->chars[j] == '\t') {
+                do {
+                    row->renderCols[index] = col++;
+                    row->render[index++] = ' ';
+                } while (col % TAB_STOP != 0);
+                row->tabs[row->nrTabs++] = (struct rowTab){ j, index };
+            }else {
+                row->renderCols[index] = col++;
+                row->render[index++] = row->chars[j];
+            }
         }
+        if (j == row->size) break;
+
+        // bytes that don't decode are shown one column each
+        int cp;
+        int len = utf8Decode(&row->chars[j], row->size - j, &cp);
+        for (int k = 0; k < len; k++) {
+            row->renderCols[index] = col;
+            row->render[index++] = row->chars[j++];
+        }
+        col += (cp < 0) ? 1 : utf8Width(cp);
     }
-    return cx;
+    row->renderCols[index] = col;
+    row->render[index] = '\0';
+    row->rsize = index;
 }
 
 void editorUpdateRow(erow *row) {
@@ -374,11 +1123,123 @@ void editorUpdateRow(erow *row) {
         }
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(TAB_STOP - 1) + 1);
+    editorRowReserveTabs(row, tabs);
+    row->nrTabs = 0;
+    if (utf8AsciiPrefix(row->chars, row->size) < (size_t)row->size) {
+        editorUpdateRowUtf8(row, tabs);
+    }else {
+        rowFree(&E.buf->heap, ROW_COLS, row->renderCols, sizeof(int) * row->renderCap);
+        row->renderCols = NULL;
+        editorRowReserveRender(row, row->size + tabs*(TAB_STOP - 1));
 
-    int index = 0;
-    for (j = 0; j < row->size; j++) {
+        int index = 0;
+        for (j = 0; j < row->size; j++) {
+            if (row->chars[j] == '\t') {
+                row->render[index++] = ' ';
+                while (index % TAB_STOP != 0) {
+                    row->render[index++] = ' ';
+                }
+                row->tabs[row->nrTabs++] = (struct rowTab){ j, index };
+            }else {
+                row->render[index++] = row->chars[j];
+            }
+        }
+
+        row->render[index] = '\0';
+        row->rsize = index;
+    }
+
+    // highlighting is redone lazily, when the row is drawn
+    row->hlDirty = 1;
+    rowTreeSetMark((rowNode *)row, 1);
+}
+
+// render column reached by rendering `len` bytes of s from column rx
+static int editorRenderWidth(const char *s, int len, int rx) {
+    for (int j = 0; j < len; j++) {
+        if (s[j] == '\t') rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+        rx++;
+    }
+    return rx;
+}
+
+static void editorRowMoveRender(erow *row, unsigned char *hl, int from, int to, int len) {
+    if (from == to || len <= 0) return;
+    memmove(&row->render[to], &row->render[from], len);
+    memmove(&hl[to], &hl[from], len);
+}
+
+/* Brings the tab index up to date after an in-place patch: the tabs that
+ * were removed go, those in the inserted text come in at the render offsets
+ * they were just written to, and the ones after the edit move with their
+ * text, by the same distance as the first of them. */
+static void editorRowPatchTabs(erow *row, int at, int removedLen, int insertedLen, int rx, int shift) {
+    int first = editorRowTabAfter(row, at);
+    int last = editorRowTabAfter(row, at + removedLen);
+    int added = 0;
+    for (int j = at; j < at + insertedLen; j++) {
+        if (row->chars[j] == '\t') added++;
+    }
+    if (row->nrTabs == 0 && added == 0) return;
+
+    int nrTabs = row->nrTabs - (last - first) + added;
+    editorRowReserveTabs(row, nrTabs);
+    memmove(&row->tabs[first + added], &row->tabs[last], sizeof(struct rowTab) * (row->nrTabs - last));
+    row->nrTabs = nrTabs;
+    for (int k = first + added; k < nrTabs; k++) {
+        row->tabs[k].at += insertedLen - removedLen;
+        row->tabs[k].end += shift;
+    }
+
+    int index = rx;
+    int k = first;
+    for (int j = at; j < at + insertedLen; j++) {
+        if (row->chars[j] == '\t') {
+            index += TAB_STOP - index % TAB_STOP;
+            row->tabs[k++] = (struct rowTab){ j, index };
+        }else {
+            index++;
+        }
+    }
+}
+
+/* Patches render and highlighting after chars[at, at + insertedLen) replaced
+ * the removedLen bytes in `removed`. Only the new text and the tab that
+ * follows it are rendered again; the plain text in between moves over and
+ * everything past that tab is either in place or off by whole tab stops.
+ * The spans are laid out as bytes for the move and encoded again after. */
+static void editorRowPatch(erow *row, int at, const char *removed, int removedLen, int insertedLen) {
+    // columns past a multibyte character aren't render offsets any more
+    if (row->render == NULL || row->renderCols
+        || utf8AsciiPrefix(&row->chars[at], insertedLen) < (size_t)insertedLen) {
+        editorUpdateRow(row);
+        return;
+    }
+
+    int rx = editorRowCxToRx(row, at);
+    int oldRx = editorRenderWidth(removed, removedLen, rx);
+    int newRx = editorRenderWidth(&row->chars[at], insertedLen, rx);
+
+    int rest = at + insertedLen;
+    char *tab = memchr(&row->chars[rest], '\t', row->size - rest);
+    int plain = tab ? tab - &row->chars[rest] : row->size - rest;
+    int oldTail = tab ? editorRenderWidth("\t", 1, oldRx + plain) : oldRx + plain;
+    int newTail = tab ? editorRenderWidth("\t", 1, newRx + plain) : newRx + plain;
+    int tailLen = row->rsize - oldTail;
+
+    editorRowReserveRender(row, newTail + tailLen);
+    unsigned char *hl = editorHlScratch(row->rsize > newTail + tailLen ? row->rsize : newTail + tailLen);
+    editorHlDecode(row, hl);
+    if (newRx > oldRx) {
+        editorRowMoveRender(row, hl, oldTail, newTail, tailLen);
+        editorRowMoveRender(row, hl, oldRx, newRx, plain);
+    }else {
+        editorRowMoveRender(row, hl, oldRx, newRx, plain);
+        editorRowMoveRender(row, hl, oldTail, newTail, tailLen);
+    }
+
+    int index = rx;
+    for (int j = at; j < at + insertedLen; j++) {
         if (row->chars[j] == '\t') {
             row->render[index++] = ' ';
             while (index % TAB_STOP != 0) {
@@ -388,456 +1249,2351 @@ void editorUpdateRow(erow *row) {
             row->render[index++] = row->chars[j];
         }
     }
+    memset(&row->render[newRx + plain], ' ', newTail - newRx - plain);
+    row->rsize = newTail + tailLen;
+    row->render[row->rsize] = '\0';
+    editorRowPatchTabs(row, at, removedLen, insertedLen, rx, newTail - oldTail);
 
-    row->render[index] = '\0';
-    row->rsize = index;
-
-    editorUpdateSyntax(row);
+    // text before rx and the plain text moved to newRx kept their colors
+    editorSyntaxPatch(row, hl, rx, tab ? newTail : newRx);
 }
 
 void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > E.nrRows) return;
+    if (at < 0 || at > E.buf->nrRows) return;
+
+    editorSplitSpan(at);
+    rowNode *node = rowTreeNewNode();
+    if (node == NULL) die("malloc");
+    erow *row = &node->row;
+
+    row->size = len;
+    row->charsCap = rowAllocSize(len + 1);
+    row->chars = rowAlloc(&E.buf->heap, ROW_CHARS, row->charsCap);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+
+    row->rsize = 0;
+    row->renderCap = 0;
+    row->render = NULL;
+    row->renderCols = NULL;
+    row->tabs = NULL;
+    row->nrTabs = 0;
+    row->tabsCap = 0;
+    row->hl = NULL;
+    row->nrHl = 0;
+    row->hlCap = 0;
+    row->hlOpenComment = 0;
+
+    rowTreeInsert(&E.buf->rows, at, node);
+    editorUpdateRow(row);
+    editorUndoRecord(UNDO_INSERT_ROW, at, 0, s, len);
 
-    E.row = realloc(E.row, sizeof(erow) * (E.nrRows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.nrRows - at));
-    for (int j = at + 1; j <= E.nrRows; j++) {
-        E.row[j].index++;
+    rowNode *next = rowTreeNext(node);
+    if (next && next->span == 0) {
+        rowTreeSetMark(next, 1);
     }
 
-    E.row[at].index = at;
-
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].highlight = NULL;
-    E.row[at].hlOpenComment = 0;
-    editorUpdateRow(&E.row[at]);
-
-    E.nrRows++;
-    E.dirty++;
+    E.buf->nrRows++;
+    E.buf->dirty++;
 }
 
 void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->highlight);
+    rowFree(&E.buf->heap, ROW_RENDER, row->render, row->renderCap);
+    rowFree(&E.buf->heap, ROW_HL, row->hl, sizeof(struct hlSpan) * row->hlCap);
+    rowFree(&E.buf->heap, ROW_COLS, row->renderCols, sizeof(int) * row->renderCap);
+    rowFree(&E.buf->heap, ROW_TABS, row->tabs, sizeof(struct rowTab) * row->tabsCap);
+    if (editorSaveShares(row)) {
+        editorSaveRetire(row->chars, row->charsCap);
+    }else if (!row->charsMapped) {
+        rowFree(&E.buf->heap, ROW_CHARS, row->chars, row->charsCap);
+    }
+}
+
+// gives a row its own copy of chars before an edit, if they still point
+// into the mapped file or the save in progress is reading them
+void editorRowPromote(erow *row) {
+    int shared = editorSaveShares(row);
+    if (!row->charsMapped && !shared) return;
+
+    int cap = rowAllocSize(row->size + 1);
+    char *chars = rowAlloc(&E.buf->heap, ROW_CHARS, cap);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    if (shared) editorSaveRetire(row->chars, row->charsCap);
+    row->chars = chars;
+    row->charsCap = cap;
+    row->charsMapped = 0;
+    row->saveGen = 0;
 }
 
 void editorDelRow(int at) {
-    if (at < 0 || at >= E.nrRows) return;
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.nrRows - at - 1));
-    E.nrRows--;
+    if (at < 0 || at >= E.buf->nrRows) return;
+    rowNode *node = (rowNode *)editorRowAt(at);
+    editorUndoRecord(UNDO_DELETE_ROW, at, 0, node->row.chars, node->row.size);
+    rowNode *next = rowTreeNext(node);
+    if (next && next->span == 0) {
+        rowTreeSetMark(next, 1);
+    }
+    rowTreeRemove(&E.buf->rows, node);
+    editorFreeRow(&node->row);
+    free(node);
+    E.buf->nrRows--;
+
+    E.buf->dirty++;
+}
 
-    for (int j = at; j < E.nrRows; j++) {
-        E.row[j].index = j;
+// replaces chars[at, at + removeLen) with s[0, insertLen)
+void editorRowSplice(erow *row, int at, int removeLen, const char *s, int insertLen) {
+    editorRowPromote(row);
+    char removedChar;
+    char *removed = NULL;
+    if (removeLen > 0) {
+        removed = (removeLen == 1) ? &removedChar : malloc(removeLen);
+        if (removed == NULL) die("malloc");
+        memcpy(removed, &row->chars[at], removeLen);
+        editorUndoRecord(UNDO_DELETE_CHARS, editorRowIndex(row), at, removed, removeLen);
+    }
+    if (insertLen > 0) {
+        editorUndoRecord(UNDO_INSERT_CHARS, editorRowIndex(row), at, s, insertLen);
     }
 
-    E.dirty++;
+    editorRowReserveChars(row, row->size - removeLen + insertLen);
+    memmove(&row->chars[at + insertLen], &row->chars[at + removeLen], row->size - at - removeLen + 1);
+    if (insertLen > 0) memcpy(&row->chars[at], s, insertLen);
+    row->size += insertLen - removeLen;
+    editorRowPatch(row, at, removed, removeLen, insertLen);
+    if (removeLen > 1) free(removed);
+    E.buf->dirty++;
 }
 
 void editorRowInsertChar(erow *row, int at, int c) {
     if (at < 0 || at > row-> size) {
         at = row->size;
     }
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at+1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.dirty++;
+    char ch = c;
+    editorRowSplice(row, at, 0, &ch, 1);
 }
 
 void editorRowAppenString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memmove(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;
+    editorRowSplice(row, row->size, 0, s, len);
 }
 
 void editorRowDelChar(erow *row, int at) {
     if (at < 0 || at >= row->size) return;
-    memmove(&row-> chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    E.dirty++;
+    editorRowSplice(row, at, 1, NULL, 0);
 }
 
 /*** editor operations ***/
 
+// refuses an edit to a read-only buffer, saying why
+static int editorReadOnly(void) {
+    if (!E.buf->readOnly) return 0;
+    editorSetStatusMessage("Read-only: opened with -R");
+    return 1;
+}
+
 void editorInserChar(int c) {
-    if (E.cursorY == E.nrRows) {
-        editorInsertRow(E.nrRows ,"", 0);
+    if (editorReadOnly()) return;
+    if (E.follow) editorFollowDetach();
+    if (E.buf->cursorY == E.buf->nrRows) {
+        editorInsertRow(E.buf->nrRows ,"", 0);
     }
-    editorRowInsertChar(&E.row[E.cursorY], E.cursorX, c);
-    E.cursorX++;
+    editorRowInsertChar(editorRowAt(E.buf->cursorY), E.buf->cursorX, c);
+    E.buf->cursorX++;
 }
 
 void editorInsertNewLine() {
-    if (E.cursorX == 0) {
-        editorInsertRow(E.cursorY, "", 0);
+    if (editorReadOnly()) return;
+    if (E.follow) editorFollowDetach();
+    if (E.buf->cursorX == 0) {
+        editorInsertRow(E.buf->cursorY, "", 0);
     }else {
-        erow *row = &E.row[E.cursorY];
-        editorInsertRow(E.cursorY + 1, &row->chars[E.cursorX], row->size - E.cursorX);
-        row->size = E.cursorX;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        erow *row = editorRowAt(E.buf->cursorY);
+        editorInsertRow(E.buf->cursorY + 1, &row->chars[E.buf->cursorX], row->size - E.buf->cursorX);
+        editorRowSplice(row, E.buf->cursorX, row->size - E.buf->cursorX, NULL, 0);
     }
-    E.cursorY++;
-    E.cursorX = 0;
+    E.buf->cursorY++;
+    E.buf->cursorX = 0;
 }
 
 void editorDelChar() {
-    if (E.cursorY == E.nrRows) return;
-    if (E.cursorX == 0 && E.cursorY == 0) return;
-
-    erow *row = &E.row[E.cursorY];
-    if (E.cursorX > 0) {
-        editorRowDelChar(row, E.cursorX - 1);
-        E.cursorX--;
+    if (editorReadOnly()) return;
+    if (E.follow) editorFollowDetach();
+    if (E.buf->cursorY == E.buf->nrRows) return;
+    if (E.buf->cursorX == 0 && E.buf->cursorY == 0) return;
+
+    erow *row = editorRowAt(E.buf->cursorY);
+    if (E.buf->cursorX > 0) {
+        int from = utf8PrevCharIndex(row, E.buf->cursorX);
+        editorRowSplice(row, from, E.buf->cursorX - from, NULL, 0);
+        E.buf->cursorX = from;
     }else {
-        E.cursorX = E.row[E.cursorY - 1].size;
-        editorRowAppenString(&E.row[E.cursorY - 1], row->chars, row->size);
-        editorDelRow(E.cursorY);
-        E.cursorY--;
+        erow *prev = editorRowPrev(row);
+        E.buf->cursorX = prev->size;
+        editorRowAppenString(prev, row->chars, row->size);
+        editorDelRow(E.buf->cursorY);
+        E.buf->cursorY--;
     }
 }
 
-/*** file I/O ***/
-
-char *editorRowToString(int *bufLen) {
-    int totLen = 0;
-    int j;
-    for (j = 0; j < E.nrRows; j++) {
-        totLen += E.row[j].size + 1;
-    }
-    *bufLen = totLen;
+// end of the line starting at p; \n, \r and \r\n all end a line
+static const char *editorLineEnd(const char *p, const char *end) {
+    while (p < end && *p != '\n' && *p != '\r') p++;
+    return p;
+}
 
-    char *buf = malloc(totLen);
-    char *p = buf;
-    for (j = 0; j < E.nrRows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
+static const char *editorSkipLineBreak(const char *p, const char *end) {
+    if (p < end && *p == '\r') {
+        p++;
+        if (p < end && *p == '\n') p++;
+    }else if (p < end) {
         p++;
     }
-    return buf;
+    return p;
 }
 
-void editorOpen(char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
+/* Inserts a block of text at the cursor in one go, for a paste: the first
+ * line goes into the cursor row, every other line becomes a new row and the
+ * text after the cursor moves behind the last one. Each row is rendered
+ * once and left to the lazy highlighter. */
+void editorInsertText(const char *text, size_t len) {
+    if (editorReadOnly()) return;
+    if (E.follow) editorFollowDetach();
+    if (E.buf->cursorY == E.buf->nrRows) {
+        editorInsertRow(E.buf->nrRows, "", 0);
+    }
+    erow *row = editorRowAt(E.buf->cursorY);
+    const char *end = text + len;
+    const char *eol = editorLineEnd(text, end);
+    if (eol == end) {
+        editorRowSplice(row, E.buf->cursorX, 0, text, len);
+        E.buf->cursorX += len;
+        return;
+    }
+
+    int tailLen = row->size - E.buf->cursorX;
+    char *tail = malloc(tailLen + 1);
+    if (tail == NULL) die("malloc");
+    memcpy(tail, &row->chars[E.buf->cursorX], tailLen);
+    editorRowSplice(row, E.buf->cursorX, tailLen, text, eol - text);
+
+    int y = E.buf->cursorY;
+    const char *p = editorSkipLineBreak(eol, end);
+    while ((eol = editorLineEnd(p, end)) != end) {
+        editorInsertRow(++y, (char *)p, eol - p);
+        p = editorSkipLineBreak(eol, end);
+    }
+
+    int lastLen = end - p;
+    char *last = malloc(lastLen + tailLen + 1);
+    if (last == NULL) die("malloc");
+    memcpy(last, p, lastLen);
+    memcpy(&last[lastLen], tail, tailLen);
+    editorInsertRow(++y, last, lastLen + tailLen);
+    free(last);
+    free(tail);
+
+    E.buf->cursorY = y;
+    E.buf->cursorX = lastLen;
+}
+
+/*** undo ***/
+
+/* Every edit reaches the rows through editorRowSplice, editorInsertRow or
+ * editorDelRow, which record it here, in the buffer's own log. Undoing a step replays the inverse of
+ * its ops newest first, so it costs as much as the edits it reverts. */
+// set while an edit must not be recorded: loading a file, undoing, redoing
+static int undoPaused = 0;
+
+static void editorUndoRecord(int type, int row, int at, const char *text, int len) {
+    if (undoPaused) return;
+    undoLogAdd(&E.buf->undo, type, row, at, text, len, E.buf->cursorY, E.buf->cursorX);
+}
+
+// ends the current undo step; the next edit starts a new one
+void editorUndoSeal(void) {
+    undoLogSeal(&E.buf->undo, E.buf->cursorY, E.buf->cursorX);
+}
+
+void editorUndoClear(void) {
+    undoLogFree(&E.buf->undo);
+}
+
+void editorUndoSetBudget(size_t bytes) {
+    undoLogSetBudget(&E.buf->undo, bytes);
+}
+
+size_t editorUndoBytes(void) {
+    return undoLogBytes(&E.buf->undo);
+}
+
+static void editorUndoApply(const struct undoOp *op, int inverse) {
+    int type = op->type;
+    if (inverse) {
+        switch (type) {
+            case UNDO_INSERT_CHARS: type = UNDO_DELETE_CHARS; break;
+            case UNDO_DELETE_CHARS: type = UNDO_INSERT_CHARS; break;
+            case UNDO_INSERT_ROW: type = UNDO_DELETE_ROW; break;
+            case UNDO_DELETE_ROW: type = UNDO_INSERT_ROW; break;
+        }
+    }
+
+    switch (type) {
+        case UNDO_INSERT_CHARS:
+            editorRowSplice(editorRowAt(op->row), op->at, 0, undoOpText(op), op->len);
+            break;
+        case UNDO_DELETE_CHARS:
+            editorRowSplice(editorRowAt(op->row), op->at, op->len, NULL, 0);
+            break;
+        case UNDO_INSERT_ROW:
+            editorInsertRow(op->row, (char *)undoOpText(op), op->len);
+            break;
+        case UNDO_DELETE_ROW:
+            editorDelRow(op->row);
+            break;
+    }
+}
+
+int editorUndo(void) {
+    editorUndoSeal();
+    struct undoOp *group = undoLogUndo(&E.buf->undo);
+    if (group == NULL) return 0;
+
+    const struct undoOp *op = group;
+    const struct undoOp *next;
+    while ((next = undoLogNext(&E.buf->undo, op)) != NULL) {
+        op = next;
+    }
+    undoPaused = 1;
+    for (; op != NULL; op = undoLogPrev(&E.buf->undo, op)) {
+        editorUndoApply(op, 1);
+    }
+    undoPaused = 0;
+
+    E.buf->cursorY = group->row;
+    E.buf->cursorX = group->at;
+    return 1;
+}
+
+int editorRedo(void) {
+    editorUndoSeal();
+    struct undoOp *group = undoLogRedo(&E.buf->undo);
+    if (group == NULL) return 0;
+
+    undoPaused = 1;
+    for (const struct undoOp *op = undoLogNext(&E.buf->undo, group); op != NULL; op = undoLogNext(&E.buf->undo, op)) {
+        editorUndoApply(op, 0);
+    }
+    undoPaused = 0;
+
+    undoLogCursorAfter(group, &E.buf->cursorY, &E.buf->cursorX);
+    return 1;
+}
+
+/*** file I/O ***/
+
+char *editorRowToString(int *bufLen) {
+    int totLen = 0;
+    rowNode *node;
+    char *chars;
+    int len;
+    for (node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        for (int j = 0; j < node->span; j++) {
+            editorMapLine(node->mapLine + j, &chars, &len);
+            totLen += len + 1;
+        }
+        if (node->span == 0) {
+            totLen += node->row.size + 1;
+        }
+    }
+    *bufLen = totLen;
+
+    char *buf = malloc(totLen);
+    char *p = buf;
+    for (node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        for (int j = 0; j < node->span; j++) {
+            editorMapLine(node->mapLine + j, &chars, &len);
+            memcpy(p, chars, len);
+            p += len;
+            *p = '\n';
+            p++;
+        }
+        if (node->span == 0) {
+            memcpy(p, node->row.chars, node->row.size);
+            p += node->row.size;
+            *p = '\n';
+            p++;
+        }
+    }
+    return buf;
+}
+
+/*** mapped files ***/
+
+void editorMapLine(int line, char **chars, int *len) {
+    size_t lineLen;
+    *chars = (char *)lineIndexLine(&E.buf->map.index, E.buf->map.data, E.buf->map.size, line, &lineLen);
+    *len = lineLen;
+}
+
+// offset of line in the mapped file, its size past the last line
+static size_t editorMapLineStart(int line) {
+    return (line < E.buf->map.index.nrStarts) ? lineIndexStart(&E.buf->map.index, line) : E.buf->map.size;
+}
+
+int editorMapIndexing(void) {
+    return E.buf->map.data != NULL && E.buf->map.scanned < E.buf->map.size;
+}
+
+// scans up to `budget` more bytes and appends the lines found to the buffer
+void editorMapIndexSlice(size_t budget) {
+    if (!editorMapIndexing()) return;
+
+    size_t end = E.buf->map.scanned + budget;
+    if (end > E.buf->map.size) end = E.buf->map.size;
+
+    lineIndexScan(&E.buf->map.index, E.buf->map.data, E.buf->map.scanned, end, E.buf->map.size);
+    E.buf->map.scanned = end;
+
+    // the last start only becomes a whole line once its end has been seen
+    int lines = E.buf->map.index.nrStarts - (editorMapIndexing() ? 1 : 0);
+    if (lines > E.buf->map.nrLines) {
+        rowNode *node = rowTreeNewNode();
+        if (node == NULL) die("malloc");
+        node->span = lines - E.buf->map.nrLines;
+        node->mapLine = E.buf->map.nrLines;
+        rowTreeInsert(&E.buf->rows, E.buf->nrRows, node);
+        E.buf->nrRows += node->span;
+        E.buf->map.nrLines = lines;
+    }
+}
+
+void editorMapFinishIndex(void) {
+    while (editorMapIndexing()) {
+        editorMapIndexSlice(MAP_INDEX_SLICE);
+    }
+}
+
+// indexes far enough that line `line` (or the end of the file) is known
+static void editorMapIndexToLine(int line) {
+    while (editorMapIndexing() && E.buf->nrRows <= line) {
+        editorMapIndexSlice(MAP_INDEX_SLICE);
+    }
+}
+
+/* Maps the file read-only and indexes only enough of it to fill the first
+ * screen; the rest is indexed from editorIdle and lines are materialized
+ * into rows as they are drawn or edited. */
+int editorOpenMapped(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    if (E.buf->filename != filename) {
+        free(E.buf->filename);
+        E.buf->filename = strdup(filename);
+    }
+    editorSelectSyntaxHighlight();
+
+    E.buf->map.data = data;
+    E.buf->map.size = st.st_size;
+    E.buf->map.scanned = 0;
+    E.buf->map.nrLines = 0;
+    lineIndexInit(&E.buf->map.index);
+    lineIndexAdd(&E.buf->map.index, 0);
+
+    do {
+        editorMapIndexSlice(MAP_MIN_SIZE);
+    } while (editorMapIndexing() && E.buf->nrRows <= E.screenrows);
+
+    E.buf->dirty = 0;
+    return 0;
+}
+
+static void editorReleaseNode(rowNode *node) {
+    if (node->span == 0) {
+        editorFreeRow(&node->row);
+    }
+    free(node);
+}
+
+// drops every row and unmaps the file, leaving an empty buffer
+void editorCloseFile(void) {
+    editorSaveWait();
+    editorUndoClear();
+    rowTreeClear(&E.buf->rows, editorReleaseNode);
+    rowHeapRelease(&E.buf->heap);
+    E.buf->nrRows = 0;
+
+    if (E.buf->map.copied) {
+        free(E.buf->map.data);
+    }else if (E.buf->map.data) {
+        munmap(E.buf->map.data, E.buf->map.size);
+    }
+    lineIndexFree(&E.buf->map.index);
+    memset(&E.buf->map, 0, sizeof(E.buf->map));
+}
+
+// reads a file into the buffer, or maps it; a pager or -F maps even small files
+int editorOpen(char *filename) {
+    free(E.buf->filename);
+    E.buf->filename = strdup(filename);
+
+    struct stat st;
+    int mapSmall = E.buf->readOnly || E.follow;
+    if (stat(filename, &st) == 0 && S_ISREG(st.st_mode) && (st.st_size >= MAP_MIN_SIZE || mapSmall)) {
+        if (editorOpenMapped(E.buf->filename) == 0) return 0;
+    }
 
     editorSelectSyntaxHighlight();
 
     FILE *fp = fopen(filename, "r");
     if (!fp) {
-        die("fopen");
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        return -1;
     }
 
-    char *line = NULL;
-    size_t lineCap = 0;
-    ssize_t lineLen;
-    while ((lineLen = getline(&line, &lineCap, fp)) != -1) {
-        while (lineLen > 0 && (line[lineLen - 1] == '\n' || line[lineLen - 1] == '\r')) {
-            lineLen--;
+    size_t size = 0;
+    size_t cap = 64 * 1024;
+    char *buf = malloc(cap);
+    size_t n;
+    while (buf && (n = fread(&buf[size], 1, cap - size, fp)) > 0) {
+        size += n;
+        if (size == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
         }
-
-        editorInsertRow(E.nrRows ,line, lineLen);
     }
-    free(line);
+    if (buf == NULL) die("malloc");
     fclose(fp);
-    E.dirty = 0;
+
+    struct lineIndex index;
+    lineIndexInit(&index);
+    if (size > 0) {
+        lineIndexAdd(&index, 0);
+        lineIndexScan(&index, buf, 0, size, size);
+    }
+    undoPaused = 1;
+    for (int line = 0; line < index.nrStarts; line++) {
+        size_t lineLen;
+        const char *text = lineIndexLine(&index, buf, size, line, &lineLen);
+        editorInsertRow(E.buf->nrRows, (char *)text, lineLen);
+    }
+    undoPaused = 0;
+    lineIndexFree(&index);
+    free(buf);
+    E.buf->dirty = 0;
+    // a file read in whole is highlighted in whole; a mapped one stays lazy
+    editorSyntaxAll(0);
+    return 0;
+}
+
+/*** save ***/
+
+// files smaller than this are saved in the foreground, bigger ones on a thread
+#define SAVE_THREAD_MIN (4 << 20)
+// buffers handed to one writev
+#define SAVE_IOV 256
+
+/* Text to write: an edited row, which gets a '\n' appended, or a run of the
+ * mapped file written as it is apart from \r\n endings, which become \n
+ * like editorMapLine reads them. */
+struct saveSegment {
+    const char *data;
+    size_t len;
+    int mapped;
+};
+
+// a row's chars the save still reads, with the size to free them by
+struct savedChars {
+    char *chars;
+    int cap;
+};
+
+/* The save in progress. Segments point at row chars and into the mapping,
+ * so while it runs a row it covers (saveGen == W.gen) gets a copy of its
+ * chars before being edited and the old buffer waits in retired until the
+ * writer is done with it. written and done belong to the writer under lock. */
+static struct {
+    int active;
+    int threaded;
+    unsigned int gen;
+    struct saveSegment *segs;
+    int nrSegs;
+    size_t bytes;
+    char *target;
+    char *tmp;
+    int fd;
+    struct editorBuffer *buf;
+    int dirty;
+    struct savedChars *retired;
+    int nrRetired;
+    int capRetired;
+    size_t written;
+    int done;
+    int error;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    struct iovec iov[SAVE_IOV];
+    int nrIov;
+} W = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void editorSaveAddSegment(const char *data, size_t len, int mapped, int *cap) {
+    struct saveSegment *prev = W.nrSegs ? &W.segs[W.nrSegs - 1] : NULL;
+    if (mapped && prev && prev->mapped && prev->data + prev->len == data) {
+        prev->len += len;
+    }else {
+        if (W.nrSegs == *cap) {
+            *cap = *cap ? *cap * 2 : 64;
+            W.segs = realloc(W.segs, sizeof(struct saveSegment) * *cap);
+            if (W.segs == NULL) die("realloc");
+        }
+        W.segs[W.nrSegs++] = (struct saveSegment){ data, len, mapped };
+    }
+    W.bytes += len;
+}
+
+static void editorSaveSnapshot(void) {
+    int cap = 0;
+    W.nrSegs = 0;
+    W.bytes = 0;
+
+    for (rowNode *node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        if (node->span || node->row.charsMapped) {
+            int lines = node->span ? node->span : 1;
+            size_t start = editorMapLineStart(node->mapLine);
+            size_t end = editorMapLineStart(node->mapLine + lines);
+            editorSaveAddSegment(&E.buf->map.data[start], end - start, 1, &cap);
+        }else {
+            node->row.saveGen = W.gen;
+            editorSaveAddSegment(node->row.chars, node->row.size, 0, &cap);
+        }
+    }
+    if (editorMapIndexing()) {
+        size_t start = editorMapLineStart(E.buf->map.nrLines);
+        editorSaveAddSegment(&E.buf->map.data[start], E.buf->map.size - start, 1, &cap);
+    }
+}
+
+// whether the save in progress still reads row's chars
+static int editorSaveShares(erow *row) {
+    return W.active && !row->charsMapped && row->saveGen == W.gen;
+}
+
+static void editorSaveRetire(char *chars, int cap) {
+    if (W.nrRetired == W.capRetired) {
+        W.capRetired = W.capRetired ? W.capRetired * 2 : 64;
+        W.retired = realloc(W.retired, sizeof(struct savedChars) * W.capRetired);
+        if (W.retired == NULL) die("realloc");
+    }
+    W.retired[W.nrRetired++] = (struct savedChars){ chars, cap };
+}
+
+// writes the gathered buffers, picking up after short writes
+static int editorSaveFlush(void) {
+    struct iovec *iov = W.iov;
+    int nrIov = W.nrIov;
+    W.nrIov = 0;
+
+    while (nrIov > 0) {
+        ssize_t n = writev(W.fd, iov, nrIov);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        pthread_mutex_lock(&W.lock);
+        W.written += n;
+        pthread_mutex_unlock(&W.lock);
+
+        while (nrIov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            nrIov--;
+        }
+        if (nrIov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int editorSaveAdd(const char *data, size_t len) {
+    if (len == 0) return 0;
+    if (W.nrIov == SAVE_IOV && editorSaveFlush() == -1) return -1;
+    W.iov[W.nrIov++] = (struct iovec){ (void *)data, len };
+    return 0;
+}
+
+// a mapped run minus the \r before each line end
+static int editorSaveAddMapped(const char *p, size_t len) {
+    const char *end = p + len;
+    const char *cr;
+    while ((cr = memchr(p, '\r', end - p)) != NULL) {
+        const char *after = cr;
+        while (after < end && *after == '\r') after++;
+        int lineEnd = (after == end || *after == '\n');
+        if (editorSaveAdd(p, (lineEnd ? cr : after) - p) == -1) return -1;
+        p = after;
+    }
+    if (editorSaveAdd(p, end - p) == -1) return -1;
+    if (len > 0 && end[-1] != '\n') return editorSaveAdd("\n", 1);
+    return 0;
+}
+
+static void *editorSaveWrite(void *arg) {
+    (void)arg;
+    int failed = 0;
+    for (int i = 0; i < W.nrSegs && !failed; i++) {
+        const struct saveSegment *s = &W.segs[i];
+        if (s->mapped) {
+            failed = editorSaveAddMapped(s->data, s->len) == -1;
+        }else {
+            failed = editorSaveAdd(s->data, s->len) == -1 || editorSaveAdd("\n", 1) == -1;
+        }
+    }
+    if (!failed) failed = editorSaveFlush() == -1;
+    if (!failed && SAVE_FSYNC) failed = fsync(W.fd) == -1;
+    int error = failed ? errno : 0;
+    if (close(W.fd) == -1 && !failed) error = errno;
+
+    pthread_mutex_lock(&W.lock);
+    W.error = error;
+    W.done = 1;
+    pthread_mutex_unlock(&W.lock);
+    editorWake();
+    return NULL;
+}
+
+// moves the finished file into place and frees what the writer held on to
+static void editorSaveFinish(void) {
+    if (W.threaded) {
+        pthread_join(W.worker, NULL);
+        W.threaded = 0;
+    }
+    if (W.error == 0 && rename(W.tmp, W.target) == -1) W.error = errno;
+    if (W.error) {
+        unlink(W.tmp);
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(W.error));
+    }else {
+        W.buf->dirty = (W.buf->dirty > W.dirty) ? W.buf->dirty - W.dirty : 0;
+        editorSetStatusMessage("%zu bytes written to disk", W.written);
+        if (E.follow) editorFollowSaved(W.buf);
+    }
+
+    for (int i = 0; i < W.nrRetired; i++) {
+        rowFree(&W.buf->heap, ROW_CHARS, W.retired[i].chars, W.retired[i].cap);
+    }
+    W.nrRetired = 0;
+    free(W.target);
+    free(W.tmp);
+    W.target = W.tmp = NULL;
+    W.active = 0;
+}
+
+// reports progress of a background save and finishes it once written
+int editorSavePoll(void) {
+    if (!W.active) return 0;
+
+    pthread_mutex_lock(&W.lock);
+    size_t written = W.written;
+    int done = W.done;
+    pthread_mutex_unlock(&W.lock);
+
+    if (done) {
+        editorSaveFinish();
+    }else {
+        editorSetStatusMessage("Saving... %d%%", W.bytes ? (int)(written * 100 / W.bytes) : 0);
+    }
+    return 1;
+}
+
+// keeps the loop coming back to editorSavePoll while a save runs
+static void editorSaveProgress(void) {
+    if (W.active) editorTimerArm(TIMER_SAVE_PROGRESS, 0.1);
 }
 
+// blocks until the save in progress is finished, before quitting or
+// closing the file it reads from
+void editorSaveWait(void) {
+    if (!W.active) return;
+    if (W.threaded) {
+        pthread_join(W.worker, NULL);
+        W.threaded = 0;
+    }
+    editorSaveFinish();
+}
+
+/* Writes a temporary file next to the target and renames it over the
+ * target once it is complete, so a failed or interrupted save leaves the
+ * old file as it was. The mapping of the old file stays valid after the
+ * rename, since it keeps the replaced inode alive. */
 void editorSave() {
     static int saveTimes = SAVE_TIMES;
 
-    if (E.filename == NULL) {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (E.filename == NULL) {
+    if (W.active) {
+        editorSetStatusMessage("Save already in progress");
+        return;
+    }
+    if (editorReadOnly()) return;
+
+    if (E.buf->filename == NULL) {
+        E.buf->filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (E.buf->filename == NULL) {
             editorSetStatusMessage("Save aborted");
             return;
         }
         editorSelectSyntaxHighlight();
     }
 
-    char *dot = strrchr(E.filename, '.');
-    if ((dot == NULL || dot[1] == '\0') && saveTimes > 0) {
-        editorSetStatusMessage("WARNING: no file extantions. "
-                        "Press CTRL-S %d more times to confirm save.", saveTimes);
+    char *dot = strrchr(E.buf->filename, '.');
+    if ((dot == NULL || dot[1] == '\0') && saveTimes > 0) {
+        editorSetStatusMessage("WARNING: no file extantions. "
+                        "Press CTRL-S %d more times to confirm save.", saveTimes);
+
+        saveTimes--;
+        return;
+    }
+
+    // saving through a symlink replaces the file it points to
+    char *target = realpath(E.buf->filename, NULL);
+    if (target == NULL) target = strdup(E.buf->filename);
+    size_t tmpLen = strlen(target) + 8;
+    char *tmp = malloc(tmpLen);
+    if (target == NULL || tmp == NULL) die("malloc");
+    snprintf(tmp, tmpLen, "%s.XXXXXX", target);
+
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        free(target);
+        free(tmp);
+        return;
+    }
+    struct stat st;
+    mode_t mode;
+    if (stat(target, &st) == 0) {
+        mode = st.st_mode & 07777;
+    }else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0644 & ~mask;
+    }
+    fchmod(fd, mode);
+
+    W.gen++;
+    W.active = 1;
+    W.target = target;
+    W.tmp = tmp;
+    W.fd = fd;
+    W.buf = E.buf;
+    W.dirty = E.buf->dirty;
+    W.written = 0;
+    W.done = 0;
+    W.error = 0;
+    editorSaveSnapshot();
+
+    if (W.bytes < SAVE_THREAD_MIN) {
+        editorSaveWrite(NULL);
+        editorSaveFinish();
+    }else if (pthread_create(&W.worker, NULL, editorSaveWrite, NULL) == 0) {
+        W.threaded = 1;
+        editorSetStatusMessage("Saving... 0%%");
+        editorTimerArm(TIMER_SAVE_PROGRESS, 0.1);
+    }else {
+        editorSaveWrite(NULL);
+        editorSaveFinish();
+    }
+}
+
+/*** find ***/
+
+// searches over fewer bytes than this run in the prompt, bigger ones on a thread
+#define FIND_THREAD_MIN (4 << 20)
+// bytes searched between handing matches over and checking for cancellation
+#define FIND_CHUNK (1 << 20)
+// matches kept; a search that finds more stops there
+#define FIND_MAX_MATCHES (1 << 22)
+
+/* A stretch of text the search runs over: an edited row (mapLine -1) or a
+ * run of unedited lines of the mapped file starting at file line mapLine.
+ * Matches can't cross lines since the prompt doesn't take control chars. */
+struct findSegment {
+    int line;
+    int mapLine;
+    const char *data;
+    size_t len;
+};
+
+struct findMatch {
+    int seg;
+    size_t offset;
+};
+
+/* Segments are taken when the prompt opens and only read while it is open,
+ * since nothing can be edited meanwhile. Every occurrence before the scan
+ * position (seg, offset) is in matches, overlapping ones included, so a
+ * longer query can start from the matches of the one it extends. While a
+ * worker runs, matches and the scan position belong to it under lock.
+ * In regex mode the query is compiled twice, since a lazy DFA fills its
+ * cache as it runs: scanRe belongs to the scan, drawRe to the main thread. */
+static struct {
+    char *query;
+    size_t queryLen;
+    int regex;
+    struct automaton *scanRe;
+    struct automaton *drawRe;
+    const char *reError;
+    char prompt[80];
+    struct findSegment *segs;
+    int nrSegs;
+    size_t bytes;
+    struct findMatch *matches;
+    int nrMatches;
+    int capMatches;
+    int seg;
+    size_t offset;
+    int done;
+    int current;
+    int cancel;
+    int threaded;
+    pthread_t worker;
+    pthread_mutex_t lock;
+} F = { .current = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void editorFindAddSegment(int line, int mapLine, const char *data, size_t len, int *cap) {
+    struct findSegment *prev = F.nrSegs ? &F.segs[F.nrSegs - 1] : NULL;
+    if (mapLine != -1 && prev && prev->mapLine != -1 && prev->data + prev->len == data) {
+        prev->len += len;
+    }else {
+        if (F.nrSegs == *cap) {
+            *cap = *cap ? *cap * 2 : 64;
+            F.segs = realloc(F.segs, sizeof(struct findSegment) * *cap);
+            if (F.segs == NULL) die("realloc");
+        }
+        F.segs[F.nrSegs++] = (struct findSegment){ line, mapLine, data, len };
+    }
+    F.bytes += len;
+}
+
+// lists the text to search; unedited lines of a mapped file, indexed or not,
+// are searched straight from the mapping
+static void editorFindSnapshot(void) {
+    int cap = 0;
+    int line = 0;
+    F.nrSegs = 0;
+    F.bytes = 0;
+
+    for (rowNode *node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        if (node->span || node->row.charsMapped) {
+            int lines = node->span ? node->span : 1;
+            size_t start = editorMapLineStart(node->mapLine);
+            size_t end = editorMapLineStart(node->mapLine + lines);
+            editorFindAddSegment(line, node->mapLine, &E.buf->map.data[start], end - start, &cap);
+            line += lines;
+        }else {
+            editorFindAddSegment(line, -1, node->row.chars, node->row.size, &cap);
+            line++;
+        }
+    }
+    if (editorMapIndexing()) {
+        size_t start = editorMapLineStart(E.buf->map.nrLines);
+        editorFindAddSegment(E.buf->nrRows, E.buf->map.nrLines, &E.buf->map.data[start], E.buf->map.size - start, &cap);
+    }
+}
+
+static void editorFindAddMatches(struct findMatch *found, int nrFound) {
+    if (nrFound == 0) return;
+    if (F.nrMatches + nrFound > F.capMatches) {
+        int cap = F.capMatches ? F.capMatches : 1024;
+        while (cap < F.nrMatches + nrFound) cap *= 2;
+        F.matches = realloc(F.matches, sizeof(struct findMatch) * cap);
+        if (F.matches == NULL) die("realloc");
+        F.capMatches = cap;
+    }
+    memcpy(&F.matches[F.nrMatches], found, sizeof(struct findMatch) * nrFound);
+    F.nrMatches += nrFound;
+}
+
+static void editorFindCollect(struct findMatch **found, int *nrFound, int *capFound, int seg, size_t at) {
+    if (*nrFound == *capFound) {
+        *capFound = *capFound ? *capFound * 2 : 256;
+        *found = realloc(*found, sizeof(struct findMatch) * *capFound);
+        if (*found == NULL) die("realloc");
+    }
+    (*found)[(*nrFound)++] = (struct findMatch){ seg, at };
+}
+
+/* Scans on from the scan position a chunk at a time, handing each chunk's
+ * matches over under lock. Runs on the worker thread for big searches. */
+static void *editorFindScan(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&F.lock);
+    int seg = F.seg;
+    size_t offset = F.offset;
+    pthread_mutex_unlock(&F.lock);
+
+    struct findMatch *found = NULL;
+    int capFound = 0;
+
+    while (seg < F.nrSegs) {
+        const struct findSegment *s = &F.segs[seg];
+        size_t chunkEnd = (s->len - offset > FIND_CHUNK) ? offset + FIND_CHUNK : s->len;
+
+        int nrFound = 0;
+        if (F.scanRe) {
+            // regex matches can't be cut, so chunks end at a line end
+            const char *nl = (chunkEnd < s->len) ? memchr(&s->data[chunkEnd], '\n', s->len - chunkEnd) : NULL;
+            if (nl) chunkEnd = nl - s->data + 1;
+            else chunkEnd = s->len;
+
+            long line;
+            size_t pos = offset;
+            while (pos < chunkEnd || (pos == 0 && chunkEnd == 0)) {
+                if ((line = automatonFindLine(F.scanRe, s->data, chunkEnd, pos)) == -1) break;
+                const char *end = memchr(&s->data[line], '\n', chunkEnd - line);
+                size_t lineLen = end ? (size_t)(end - &s->data[line]) : chunkEnd - line;
+
+                size_t from = 0, start, stop;
+                while (from <= lineLen && automatonMatchLine(F.scanRe, &s->data[line], lineLen, from, &start, &stop)) {
+                    editorFindCollect(&found, &nrFound, &capFound, seg, line + start);
+                    from = (stop > start) ? stop : stop + 1;
+                }
+                pos = line + lineLen + 1;
+            }
+        }else {
+            size_t hayEnd = (s->len - chunkEnd > F.queryLen) ? chunkEnd + F.queryLen - 1 : s->len;
+            size_t pos = offset;
+            const char *match;
+            while (pos < chunkEnd && (match = substringFind(&s->data[pos], hayEnd - pos, F.query, F.queryLen)) != NULL) {
+                size_t at = match - s->data;
+                if (at >= chunkEnd) break;
+                editorFindCollect(&found, &nrFound, &capFound, seg, at);
+                pos = at + 1;
+            }
+        }
+
+        offset = chunkEnd;
+        if (offset == s->len) {
+            seg++;
+            offset = 0;
+        }
+
+        pthread_mutex_lock(&F.lock);
+        editorFindAddMatches(found, nrFound);
+        F.seg = seg;
+        F.offset = offset;
+        int stop = F.cancel || F.nrMatches >= FIND_MAX_MATCHES;
+        pthread_mutex_unlock(&F.lock);
+        if (nrFound > 0) editorWake();
+        if (stop) break;
+    }
+
+    pthread_mutex_lock(&F.lock);
+    F.done = 1;
+    pthread_mutex_unlock(&F.lock);
+    editorWake();
+    free(found);
+    return NULL;
+}
+
+static void editorFindStopWorker(void) {
+    if (!F.threaded) return;
+    pthread_mutex_lock(&F.lock);
+    F.cancel = 1;
+    pthread_mutex_unlock(&F.lock);
+    pthread_join(F.worker, NULL);
+    F.threaded = 0;
+    F.cancel = 0;
+}
+
+/* Starts a search for `query`. If it extends the previous query only the
+ * previous matches can still match before the scan position, so those are
+ * filtered and the scan carries on from where it was. */
+static void editorFindStart(const char *query) {
+    editorFindStopWorker();
+
+    size_t queryLen = strlen(query);
+    automatonFree(F.scanRe);
+    automatonFree(F.drawRe);
+    F.scanRe = F.drawRe = NULL;
+    F.reError = NULL;
+    if (F.regex && queryLen > 0) {
+        F.scanRe = automatonCompile(query, &F.reError);
+        F.drawRe = automatonCompile(query, NULL);
+        if (F.scanRe == NULL) queryLen = 0;
+    }
+
+    if (!F.regex && F.query && queryLen > F.queryLen && strncmp(query, F.query, F.queryLen) == 0) {
+        int kept = 0;
+        for (int i = 0; i < F.nrMatches; i++) {
+            const struct findSegment *s = &F.segs[F.matches[i].seg];
+            size_t at = F.matches[i].offset;
+            if (s->len - at >= queryLen && memcmp(&s->data[at], query, queryLen) == 0) {
+                F.matches[kept++] = F.matches[i];
+            }
+        }
+        F.nrMatches = kept;
+    }else {
+        F.nrMatches = 0;
+        F.seg = 0;
+        F.offset = 0;
+    }
+
+    free(F.query);
+    F.query = strdup(query);
+    F.queryLen = queryLen;
+    F.current = -1;
+    F.done = (queryLen == 0);
+    if (F.done) {
+        F.nrMatches = 0;
+        return;
+    }
+
+    if (F.bytes < FIND_THREAD_MIN) {
+        editorFindScan(NULL);
+    }else if (pthread_create(&F.worker, NULL, editorFindScan, NULL) == 0) {
+        F.threaded = 1;
+    }else {
+        editorFindScan(NULL);
+    }
+}
+
+// moves the cursor to match `i`, putting its line at the top of the screen
+static void editorFindShow(int i) {
+    pthread_mutex_lock(&F.lock);
+    struct findMatch match = F.matches[i];
+    pthread_mutex_unlock(&F.lock);
+
+    const struct findSegment *s = &F.segs[match.seg];
+    int line = s->line;
+    int cursorX = match.offset;
+    if (s->mapLine != -1) {
+        size_t offset = &s->data[match.offset] - E.buf->map.data;
+        while (editorMapIndexing() && E.buf->map.scanned <= offset) {
+            editorMapIndexSlice(MAP_INDEX_SLICE);
+        }
+        int mapLine = lineIndexLineAt(&E.buf->map.index, offset);
+        line += mapLine - s->mapLine;
+        cursorX = offset - lineIndexStart(&E.buf->map.index, mapLine);
+    }
+
+    F.current = i;
+    E.buf->cursorY = line;
+    E.buf->cursorX = cursorX;
+    E.buf->rowOff = E.buf->nrRows;
+}
+
+/* Picks up matches the worker has found since the last call; the first one
+ * is shown as soon as it arrives. Returns 1 if the screen changed. */
+int editorFindPoll(void) {
+    if (!F.threaded) return 0;
+
+    pthread_mutex_lock(&F.lock);
+    int nrMatches = F.nrMatches;
+    int done = F.done;
+    pthread_mutex_unlock(&F.lock);
+
+    if (done) {
+        pthread_join(F.worker, NULL);
+        F.threaded = 0;
+    }
+    if (F.current == -1 && nrMatches > 0) {
+        editorFindShow(0);
+        return 1;
+    }
+    return done;
+}
+
+static void editorFindEnd(void) {
+    editorFindStopWorker();
+    automatonFree(F.scanRe);
+    automatonFree(F.drawRe);
+    F.scanRe = F.drawRe = NULL;
+    free(F.query);
+    free(F.segs);
+    free(F.matches);
+    F.query = NULL;
+    F.queryLen = 0;
+    F.segs = NULL;
+    F.nrSegs = 0;
+    F.matches = NULL;
+    F.nrMatches = 0;
+    F.capMatches = 0;
+    F.current = -1;
+}
+
+// whether the find prompt is open with something to look for
+static int editorFindActive(void) {
+    return F.queryLen > 0;
+}
+
+// the next match in line[from, len) as [*start, *end), for drawing
+static int editorFindInLine(const char *line, size_t len, size_t from, size_t *start, size_t *end) {
+    if (F.drawRe) {
+        return automatonMatchLine(F.drawRe, line, len, from, start, end);
+    }
+    const char *match = substringFind(&line[from], len - from, F.query, F.queryLen);
+    if (match == NULL) return 0;
+    *start = match - line;
+    *end = *start + F.queryLen;
+    return 1;
+}
+
+static void editorFindSetPrompt(void) {
+    if (!F.regex) {
+        snprintf(F.prompt, sizeof(F.prompt), "Find: %%s (ESC/Arrows/Enter, CTRL-R regex)");
+    }else if (F.reError) {
+        snprintf(F.prompt, sizeof(F.prompt), "Regex: %%s (%s)", F.reError);
+    }else {
+        snprintf(F.prompt, sizeof(F.prompt), "Regex: %%s (ESC/Arrows/Enter, CTRL-R literal)");
+    }
+}
+
+void editorFindCallback(char *query, int key) {
+    if (key == '\r' || key == '\x1b') {
+        editorFindEnd();
+        return;
+    }
+    if (F.segs == NULL) {
+        editorFindSnapshot();
+    }
+
+    if (key == CTRL_KEY('r') || F.query == NULL || strcmp(query, F.query) != 0) {
+        if (key == CTRL_KEY('r')) {
+            F.regex = !F.regex;
+            free(F.query);
+            F.query = NULL;
+        }
+        editorFindStart(query);
+        editorFindSetPrompt();
+        pthread_mutex_lock(&F.lock);
+        int found = F.nrMatches > 0;
+        pthread_mutex_unlock(&F.lock);
+        if (found) {
+            editorFindShow(0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&F.lock);
+    int nrMatches = F.nrMatches;
+    int done = F.done;
+    pthread_mutex_unlock(&F.lock);
+    if (nrMatches == 0) return;
+
+    if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        // past the last match found so far, wrap only once the scan is over
+        if (F.current + 1 < nrMatches) {
+            editorFindShow(F.current + 1);
+        }else if (done) {
+            editorFindShow(0);
+        }
+    }else if (key == ARROW_LEFT || key == ARROW_UP) {
+        editorFindShow(F.current > 0 ? F.current - 1 : nrMatches - 1);
+    }
+}
+
+void editorFind() {
+    int savedCursorX = E.buf->cursorX;
+    int savedCursorY = E.buf->cursorY;
+    int savedColOff = E.buf->colOff;
+    int savedRowOff = E.buf->rowOff;
+
+    editorFindSetPrompt();
+    char *query = editorPrompt(F.prompt, editorFindCallback);
+    if (query) {
+        free(query);
+    }else {
+        E.buf->cursorX = savedCursorX;
+        E.buf->cursorY = savedCursorY;
+        E.buf->colOff = savedColOff;
+        E.buf->rowOff = savedRowOff;
+    }
+}
+
+/*** go to line ***/
+
+/* Accepts a line number or a percentage. For a mapped file the percentage
+ * is of the file size, like less, so only the part of the file up to that
+ * point has to be indexed. */
+void editorGoToLine() {
+    char *input = editorPrompt("Go to line or %%: %s (ESC to cancel)", NULL);
+    if (input == NULL) return;
+
+    int line;
+    if (strchr(input, '%')) {
+        double percent = atof(input);
+        if (percent < 0) percent = 0;
+        if (percent > 100) percent = 100;
+
+        if (E.buf->map.data) {
+            size_t offset = (size_t)(E.buf->map.size * (percent / 100));
+            if (offset >= E.buf->map.size) offset = E.buf->map.size - 1;
+            while (editorMapIndexing() && E.buf->map.scanned <= offset) {
+                editorMapIndexSlice(MAP_INDEX_SLICE);
+            }
+            line = lineIndexLineAt(&E.buf->map.index, offset);
+        }else {
+            line = (int)(E.buf->nrRows * (percent / 100));
+        }
+    }else {
+        line = atoi(input) - 1;
+        if (E.buf->map.data) editorMapIndexToLine(line);
+    }
+    free(input);
+
+    if (line >= E.buf->nrRows) line = E.buf->nrRows - 1;
+    if (line < 0) line = 0;
+
+    E.buf->cursorY = line;
+    E.buf->cursorX = 0;
+    E.buf->rowOff = line - E.screenrows / 2;
+    if (E.buf->rowOff < 0) E.buf->rowOff = 0;
+}
+
+/*** pager ***/
+
+/* With -R files open read-only and mapped, however small, and a buffer only
+ * keeps the rows within PAGER_WINDOW lines of the screen. Rows further
+ * away go back into spans after every scroll, so the heap stays the same
+ * size however far through the file the view goes; only the line index
+ * grows with it. Nothing moves in a read-only buffer, so line n is always
+ * mapLine n and spans next to each other can always be merged. */
+
+// turns a row back into a line of span, merged with the spans around it
+static void editorPagerRelease(rowNode *node) {
+    editorFreeRow(&node->row);
+    memset(&node->row, 0, sizeof(node->row));
+    rowTreeSetMark(node, 0);
+    rowTreeResize(node, 1);
+
+    rowNode *prev = rowTreePrev(node);
+    if (prev && prev->span) {
+        rowTreeRemove(&E.buf->rows, node);
+        free(node);
+        rowTreeResize(prev, prev->span + 1);
+        node = prev;
+    }
+    rowNode *next = rowTreeNext(node);
+    if (next && next->span) {
+        int span = next->span;
+        rowTreeRemove(&E.buf->rows, next);
+        free(next);
+        rowTreeResize(node, node->span + span);
+    }
+}
+
+// releases the rows of a read-only buffer that are outside its window
+void editorPagerTrim(void) {
+    if (!E.buf->readOnly || E.buf->map.data == NULL) return;
+
+    int lo = E.buf->rowOff - PAGER_WINDOW;
+    int hi = E.buf->rowOff + E.screenrows + PAGER_WINDOW;
+    int at = 0, offset;
+    rowNode *node;
+    while ((node = rowTreeAt(&E.buf->rows, at, &offset)) != NULL) {
+        if (at >= lo && at < hi) {
+            at = hi;
+        }else if (node->span) {
+            at += node->span - offset;
+        }else {
+            if (node->row.charsMapped) editorPagerRelease(node);
+            at++;
+        }
+    }
+}
+
+// less's keys, which a read-only buffer has no other use for; returns the
+// key to handle in their place, or 0 if there is nothing left to do
+static int editorPagerKey(int c) {
+    switch (c) {
+        case 'q': return CTRL_KEY('q');
+        case ' ': return PAGE_DOWN;
+        case 'b': return PAGE_UP;
+        case '/': return CTRL_KEY('f');
+        case '%': return CTRL_KEY('g');
+        case 'g':
+            E.buf->cursorY = 0;
+            E.buf->cursorX = 0;
+            return 0;
+        case 'G':
+            editorMapFinishIndex();
+            E.buf->cursorY = E.buf->nrRows > 0 ? E.buf->nrRows - 1 : 0;
+            E.buf->cursorX = 0;
+            return 0;
+    }
+    return c;
+}
+
+/*** follow ***/
+
+#define FOLLOW_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+/* With -F every file is mapped and watched with inotify. When a file
+ * changes, its buffer catches up unless it has unsaved changes. If the
+ * file only grew, the mapping is extended and the new lines go in as span
+ * nodes the way indexing adds them, so a burst of lines costs a node and
+ * nothing before the old end is read again. Anything else (truncation, a
+ * rewrite, a new file renamed over it) reloads the file. The mapping can't
+ * tell an append from a rewrite, since it shows the file as it is now, so
+ * the bytes that ended the file are kept to compare. A buffer whose cursor
+ * is on its last line keeps it there as lines come in, like tail -f. */
+
+static int followFd = -1;
+
+// the bytes of the file before `size`, up to FOLLOW_LAST; -1 if unreadable
+static int editorFollowReadLast(const char *filename, off_t size, char *last) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+    off_t from = size > FOLLOW_LAST ? size - FOLLOW_LAST : 0;
+    ssize_t n = pread(fd, last, size - from, from);
+    close(fd);
+    return (n == size - from) ? (int)n : -1;
+}
+
+// remembers the file as the first `size` bytes of it are in the buffer
+static void editorFollowSync(struct editorBuffer *buf, const struct stat *st, off_t size) {
+    buf->follow.ino = st->st_ino;
+    buf->follow.size = size;
+    buf->follow.mtime = st->st_mtim;
+    buf->follow.lastLen = editorFollowReadLast(buf->filename, size, buf->follow.last);
+    // a write between the open and the stat has no event of its own
+    if (size != st->st_size) buf->follow.pending = 1;
+}
+
+// moves the watch to whatever file is at the buffer's path now
+static void editorFollowWatch(struct editorBuffer *buf, const struct stat *st) {
+    if (buf->follow.wd > 0 && st->st_ino == buf->follow.ino) return;
+    if (buf->follow.wd > 0) inotify_rm_watch(followFd, buf->follow.wd);
+    buf->follow.wd = inotify_add_watch(followFd, buf->filename, FOLLOW_EVENTS);
+    if (buf->follow.wd < 0) buf->follow.wd = 0;
+}
+
+// starts over from the file just opened in E.buf
+static void editorFollowOpened(const struct stat *st) {
+    editorFollowWatch(E.buf, st);
+    E.buf->follow.mapIno = st->st_ino;
+    editorFollowSync(E.buf, st, E.buf->map.data ? (off_t)E.buf->map.size : st->st_size);
+}
+
+// moves the cursor to the last line, indexing the file through to it
+static void editorFollowTail(void) {
+    editorMapFinishIndex();
+    E.buf->cursorY = E.buf->nrRows > 0 ? E.buf->nrRows - 1 : 0;
+    E.buf->cursorX = 0;
+}
+
+// watches the file in E.buf and shows its end
+void editorFollowStart(void) {
+    if (followFd == -1) {
+        followFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (followFd == -1) {
+            editorSetStatusMessage("Can't follow files: %s", strerror(errno));
+            return;
+        }
+    }
+    if (E.buf->filename == NULL) return;
+
+    struct stat st;
+    if (stat(E.buf->filename, &st) == -1) {
+        // not created yet
+        editorTimerArm(TIMER_FOLLOW, FOLLOW_RETRY);
+        return;
+    }
+    editorFollowOpened(&st);
+    editorFollowTail();
+}
+
+static void editorFollowSaved(struct editorBuffer *buf) {
+    struct stat st;
+    if (buf->filename == NULL || stat(buf->filename, &st) == -1) return;
+    editorFollowWatch(buf, &st);
+    editorFollowSync(buf, &st, st.st_size);
+}
+
+static void editorFollowRetry(void) {
+    for (int i = 0; i < E.nrBuffers; i++) {
+        E.buffers[i]->follow.pending = 1;
+    }
+}
+
+// whether the file is the mapped one with bytes added after its old end
+static int editorFollowAppends(const struct stat *st) {
+    struct editorFollow *f = &E.buf->follow;
+    if (E.buf->map.data == NULL || E.buf->map.copied) return 0;
+    if (st->st_ino != f->mapIno || st->st_ino != f->ino) return 0;
+    if (st->st_size <= f->size || (size_t)f->size != E.buf->map.size || f->lastLen < 0) return 0;
+
+    char last[FOLLOW_LAST];
+    return editorFollowReadLast(E.buf->filename, f->size, last) == f->lastLen &&
+           memcmp(last, f->last, f->lastLen) == 0;
+}
+
+// points the rows that weren't edited, which point into the file's text at
+// `old`, at the same bytes in `data`
+static void editorFollowRebase(const char *old, char *data) {
+    if (data == old) return;
+    for (rowNode *node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        if (node->span == 0 && node->row.charsMapped) {
+            node->row.chars = data + ((uintptr_t)node->row.chars - (uintptr_t)old);
+        }
+    }
+}
+
+/* Moves a followed buffer off the mapping before its first edit. Once it
+ * has unsaved changes it isn't reloaded, so it could outlive the file it
+ * maps being truncated or rewritten, and a row or span read from the
+ * mapping then would fault. A save running on the buffer reads from the
+ * mapping too, so it is finished first. */
+static void editorFollowDetach(void) {
+    struct editorMap *map = &E.buf->map;
+    if (map->data == NULL || map->copied) return;
+    if (W.active && W.buf == E.buf) editorSaveWait();
+
+    char *copy = malloc(map->size);
+    if (copy == NULL) die("malloc");
+    memcpy(copy, map->data, map->size);
+    editorFollowRebase(map->data, copy);
+    munmap(map->data, map->size);
+    map->data = copy;
+    map->copied = 1;
+}
+
+/* Extends the mapping to `size` bytes and indexes what was added. A line
+ * that was cut off by the old end is already a row, or in a span that
+ * reads it again when it is materialized; only a materialized one has to
+ * be told its new length. */
+static int editorFollowAppend(size_t size) {
+    struct editorMap *map = &E.buf->map;
+    char *old = map->data;
+    size_t oldSize = map->size;
+    char *data = mremap(old, oldSize, size, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED) return -1;
+    editorFollowRebase(old, data);
+    map->data = data;
+
+    int indexed = !editorMapIndexing();
+    int cutOff = data[oldSize - 1] != '\n';
+    rowNode *last = NULL;
+    if (indexed && cutOff && E.buf->nrRows > 0) {
+        last = rowTreeAt(&E.buf->rows, E.buf->nrRows - 1, NULL);
+    }else if (indexed) {
+        // the old last '\n' was the end of the file, so no line started there
+        lineIndexAdd(&map->index, oldSize);
+    }
+    map->size = size;
+    editorMapFinishIndex();
+
+    if (last && last->span == 0 && last->row.charsMapped) {
+        editorMapLine(last->mapLine, &last->row.chars, &last->row.size);
+        editorUpdateRow(&last->row);
+    }
+    return 0;
+}
+
+// reads the file again, keeping the cursor where it was if the file reaches
+static void editorFollowReload(void) {
+    int cursorY = E.buf->cursorY;
+    int cursorX = E.buf->cursorX;
+    char *filename = strdup(E.buf->filename);
+    editorCloseFile();
+    int opened = editorOpen(filename);
+    free(filename);
+
+    editorMapIndexToLine(cursorY);
+    if (cursorY > E.buf->nrRows) cursorY = E.buf->nrRows;
+    erow *row = editorRowAt(cursorY);
+    if (row == NULL) {
+        cursorX = 0;
+    }else if (cursorX > row->size) {
+        cursorX = row->size;
+    }
+    E.buf->cursorY = cursorY;
+    E.buf->cursorX = cursorX;
+
+    struct stat st;
+    if (opened == 0 && stat(E.buf->filename, &st) == 0) editorFollowOpened(&st);
+}
+
+// catches E.buf up with its file; returns 1 if anything changed
+static int editorFollowUpdate(int shown) {
+    struct editorBuffer *buf = E.buf;
+    struct editorFollow *f = &buf->follow;
+    struct stat st;
+    if (stat(buf->filename, &st) == -1) {
+        // rotated away or deleted; the buffer stays as it is until a file is back
+        editorTimerArm(TIMER_FOLLOW, FOLLOW_RETRY);
+        return 0;
+    }
+    editorFollowWatch(buf, &st);
+    if (st.st_ino == f->ino && st.st_size == f->size &&
+        st.st_mtim.tv_sec == f->mtime.tv_sec && st.st_mtim.tv_nsec == f->mtime.tv_nsec) {
+        return 0;
+    }
+    if (buf->dirty) {
+        if (shown) editorSetStatusMessage("%s changed on disk, kept unsaved changes", buf->filename);
+        editorFollowSync(buf, &st, st.st_size);
+        return shown;
+    }
+
+    int tail = !editorMapIndexing() && buf->cursorY >= buf->nrRows - 1;
+    if (editorFollowAppends(&st) && editorFollowAppend(st.st_size) == 0) {
+        editorFollowSync(buf, &st, st.st_size);
+    }else {
+        editorFollowReload();
+    }
+    if (tail) editorFollowTail();
+    return 1;
+}
+
+/* Reads the inotify events that came in and catches up every buffer whose
+ * file changed. A save or a find in progress reads from the mapping, so a
+ * buffer they are on waits for them to finish. Returns 1 if the buffer
+ * shown changed. */
+int editorFollowPoll(void) {
+    if (followFd == -1) return 0;
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(followFd, events, sizeof(events))) > 0) {
+        const struct inotify_event *ev;
+        for (char *p = events; p < events + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            for (int i = 0; i < E.nrBuffers; i++) {
+                struct editorFollow *f = &E.buffers[i]->follow;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    f->pending = 1;
+                }else if (f->wd == ev->wd) {
+                    f->pending = 1;
+                    if (ev->mask & IN_IGNORED) f->wd = 0;
+                }
+            }
+        }
+    }
+
+    struct editorBuffer *shown = E.buf;
+    int changed = 0;
+    for (int i = 0; i < E.nrBuffers; i++) {
+        struct editorBuffer *buf = E.buffers[i];
+        if (!buf->follow.pending || buf->filename == NULL) continue;
+        if ((W.active && W.buf == buf) || (buf == shown && F.segs)) continue;
+        buf->follow.pending = 0;
+        E.buf = buf;
+        if (editorFollowUpdate(buf == shown) && buf == shown) changed = 1;
+        E.buf = shown;
+    }
+    return changed;
+}
+
+/*** buffers ***/
+
+/* Every open file has its own buffer; E.buf is the one shown. A buffer in
+ * the background keeps its rows, mapping and undo log, so switching back
+ * to it costs nothing. Find only runs while its prompt is up, so always
+ * on the buffer shown; a background save keeps the buffer it started on
+ * and finishes even if another one is shown by then. */
+
+// adds an empty buffer and shows it
+struct editorBuffer *editorBufferNew(void) {
+    struct editorBuffer *buf = calloc(1, sizeof(*buf));
+    E.buffers = realloc(E.buffers, sizeof(*E.buffers) * (E.nrBuffers + 1));
+    if (buf == NULL || E.buffers == NULL) die("malloc");
+    undoLogSetBudget(&buf->undo, UNDO_BUDGET);
+    E.buffers[E.nrBuffers++] = buf;
+    E.buf = buf;
+    return buf;
+}
+
+int editorBufferIndex(void) {
+    for (int i = 0; i < E.nrBuffers; i++) {
+        if (E.buffers[i] == E.buf) return i;
+    }
+    return -1;
+}
+
+void editorBufferSwitch(int index) {
+    if (index < 0 || index >= E.nrBuffers) return;
+    editorUndoSeal();
+    E.buf = E.buffers[index];
+}
+
+// frees a buffer and everything in it; closing the last one leaves E.buf NULL
+void editorBufferClose(int index) {
+    if (index < 0 || index >= E.nrBuffers) return;
+    struct editorBuffer *shown = E.buf;
+    struct editorBuffer *buf = E.buffers[index];
+    E.buf = buf;
+    editorCloseFile();
+    if (buf->follow.wd > 0) inotify_rm_watch(followFd, buf->follow.wd);
+    free(buf->filename);
+    free(buf);
+
+    E.nrBuffers--;
+    memmove(&E.buffers[index], &E.buffers[index + 1], sizeof(*E.buffers) * (E.nrBuffers - index));
+    if (shown != buf) {
+        E.buf = shown;
+    }else if (E.nrBuffers > 0) {
+        E.buf = E.buffers[index < E.nrBuffers ? index : E.nrBuffers - 1];
+    }else {
+        E.buf = NULL;
+    }
+}
+
+// whether a buffer's file is the one at `filename`, by name or, for files
+// that exist, by inode, so foo.c, ./foo.c and a link to it are one file
+static int editorBufferHolds(struct editorBuffer *buf, const char *filename, const struct stat *st) {
+    if (buf->filename == NULL) return 0;
+    if (strcmp(buf->filename, filename) == 0) return 1;
+    struct stat held;
+    return st && stat(buf->filename, &held) == 0 && held.st_dev == st->st_dev && held.st_ino == st->st_ino;
+}
+
+// opens a file in a buffer of its own, or shows the buffer it is open in
+void editorBufferOpen(char *filename) {
+    struct stat st;
+    int exists = (stat(filename, &st) == 0);
+    for (int i = 0; i < E.nrBuffers; i++) {
+        if (editorBufferHolds(E.buffers[i], filename, exists ? &st : NULL)) {
+            editorBufferSwitch(i);
+            return;
+        }
+    }
+    // a pager has no use for a file that isn't there yet
+    if ((exists || E.pager) && access(filename, R_OK) == -1) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        return;
+    }
+
+    editorUndoSeal();
+    // the shown buffer is reused while it is empty and has no name
+    if (E.buf->filename || E.buf->nrRows > 0) editorBufferNew();
+    E.buf->readOnly = E.pager;
+    if (exists) {
+        editorOpen(filename);
+    }else {
+        E.buf->filename = strdup(filename);
+        editorSelectSyntaxHighlight();
+    }
+    if (E.follow) editorFollowStart();
+}
+
+static void editorBufferPrompt(void) {
+    char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (filename == NULL) return;
+    editorBufferOpen(filename);
+    free(filename);
+}
+
+static int editorBuffersDirty(void) {
+    int dirty = 0;
+    for (int i = 0; i < E.nrBuffers; i++) {
+        if (E.buffers[i]->dirty) dirty++;
+    }
+    return dirty;
+}
+
+static void editorBufferStep(int step) {
+    int index = (editorBufferIndex() + step + E.nrBuffers) % E.nrBuffers;
+    editorBufferSwitch(index);
+    editorSetStatusMessage("buffer %d/%d: %s", index + 1, E.nrBuffers,
+                           E.buf->filename ? E.buf->filename : "[No Filename]");
+}
+
+// closes the shown buffer, asking again first if it has unsaved changes
+static void editorBufferCloseShown(void) {
+    static int closeTimes = QUIT_TIMES;
+    if (E.buf->dirty && closeTimes > 0) {
+        editorSetStatusMessage("WARNING!!!!! File has unsaved changes. "
+                               "Press CTRL-W %d more times to close it", closeTimes);
+        closeTimes--;
+        return;
+    }
+    closeTimes = QUIT_TIMES;
+    editorBufferClose(editorBufferIndex());
+    if (E.nrBuffers == 0) editorBufferNew();
+    editorBufferStep(0);
+}
+
+/*** memory report ***/
+
+static const char *rowKindNames[ROW_KINDS] = { "chars", "render", "column maps", "tab index", "hl spans" };
+
+// row nodes in the tree, counting each unmaterialized span as one
+static long editorCountNodes(struct editorBuffer *buf) {
+    long nodes = 0;
+    for (rowNode *node = rowTreeAt(&buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        nodes++;
+    }
+    return nodes;
+}
+
+static size_t editorBufferBytes(struct editorBuffer *buf, long nodes) {
+    return nodes * sizeof(rowNode) + undoLogBytes(&buf->undo) + buf->heap.slabBytes + buf->heap.largeBytes
+         + lineIndexBytes(&buf->map.index) + (buf->map.copied ? buf->map.size : 0);
+}
+
+/* Writes what the shown buffer keeps in memory. Row buffers are counted by
+ * the blocks the row allocator handed out, slack is what its slabs hold
+ * beyond those, and the mapped file is page cache, not heap. The other
+ * buffers only get a total. */
+void editorMemoryReport(int fd) {
+    long nodes = editorCountNodes(E.buf);
+    size_t total = editorBufferBytes(E.buf, nodes);
+
+    dprintf(fd, "memory: %.1f MB of heap for %d lines\n", total / 1048576.0, E.buf->nrRows);
+    for (int k = 0; k < ROW_KINDS; k++) {
+        dprintf(fd, "  %-12s %12zu bytes %10zu blocks\n", rowKindNames[k], E.buf->heap.used[k], E.buf->heap.blocks[k]);
+    }
+    dprintf(fd, "  %-12s %12zu bytes %10ld nodes\n", "row nodes", nodes * sizeof(rowNode), nodes);
+    dprintf(fd, "  %-12s %12zu bytes\n", "undo log", undoLogBytes(&E.buf->undo));
+    dprintf(fd, "  %-12s %12zu bytes in %zu slabs, %zu bytes past them\n", "slack",
+            rowHeapSlack(&E.buf->heap), E.buf->heap.slabBytes / ROW_SLAB_SIZE, E.buf->heap.largeBytes);
+    dprintf(fd, "  %-12s %12zu bytes\n", "line index", lineIndexBytes(&E.buf->map.index));
+    dprintf(fd, "  %-12s %12zu bytes\n", E.buf->map.copied ? "file copy" : "mapped file", E.buf->map.size);
+
+    if (E.nrBuffers > 1) {
+        size_t others = 0;
+        for (int i = 0; i < E.nrBuffers; i++) {
+            struct editorBuffer *buf = E.buffers[i];
+            if (buf != E.buf) others += editorBufferBytes(buf, editorCountNodes(buf));
+        }
+        dprintf(fd, "  %-12s %12zu bytes in %d more\n", "buffers", others, E.nrBuffers - 1);
+    }
+}
+
+// the report in one line, for the message bar
+static void editorMemorySummary(void) {
+    double mb = 1048576.0;
+    long nodes = editorCountNodes(E.buf);
+    editorSetStatusMessage("mem MB: chars %.1f render %.1f hl %.1f tabs %.1f nodes %.1f undo %.1f slack %.1f",
+                           E.buf->heap.used[ROW_CHARS] / mb,
+                           (E.buf->heap.used[ROW_RENDER] + E.buf->heap.used[ROW_COLS]) / mb,
+                           E.buf->heap.used[ROW_HL] / mb,
+                           E.buf->heap.used[ROW_TABS] / mb, nodes * sizeof(rowNode) / mb,
+                           undoLogBytes(&E.buf->undo) / mb, rowHeapSlack(&E.buf->heap) / mb);
+}
+
+/*** Append buffer ***/
+
+/* A frame is built in one buffer that is kept between frames and only ever
+ * grows, so once it has reached the size of a full repaint drawing does no
+ * allocations at all. E.frameAllocs counts the ones that do happen. */
+
+struct abuf {
+    char *buf;
+    int len;
+    int cap;
+};
+
+#define ABUF_INIT { NULL, 0, 0 }
+
+void abAppend(struct abuf *ab, const char *str, int len) {
+    if (ab -> len + len > ab -> cap) {
+        int cap = ab -> cap ? ab -> cap : 4096;
+        while (cap < ab -> len + len) cap *= 2;
+        char *new = realloc(ab -> buf, cap);
+        if (new == NULL) return;
+        ab -> buf = new;
+        ab -> cap = cap;
+        E.frameAllocs++;
+    }
+    memcpy(&ab -> buf[ab -> len], str, len);
+    ab -> len += len;
+}
+
+// empties the buffer but keeps its memory for the next frame
+void abReset(struct abuf *ab) {
+    ab -> len = 0;
+}
+
+void abFree(struct abuf *ab) {
+    free(ab -> buf);
+    ab -> buf = NULL;
+    ab -> len = 0;
+    ab -> cap = 0;
+}
+
+// writes the whole buffer, retrying short writes
+int abWrite(struct abuf *ab, int fd) {
+    int done = 0;
+    while (done < ab -> len) {
+        ssize_t n = write(fd, &ab -> buf[done], ab -> len - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/*** Screen ***/
+
+/* The frame is drawn into `cells`; `shown` holds what the terminal was last
+ * sent. screenFlush only emits the cells that differ, so a keypress that
+ * changes one character costs a cursor move and a few bytes instead of a
+ * full repaint.
+ * A cell holds the UTF-8 bytes of one character and of any combining marks
+ * drawn over it. A wide character fills its cell and the next one, which
+ * is left with len 0 and is written along with it. */
+
+#define ATTR_INVERSE 0x80
+#define ATTR_UNKNOWN 0xff
+// at most this many unchanged cells are rewritten instead of moving past them
+#define SCREEN_MAX_GAP 3
+#define CELL_BYTES 8
+
+struct screenCell {
+    char ch[CELL_BYTES];
+    unsigned char len;
+    unsigned char attr;
+};
+
+struct screen {
+    int rows;
+    int cols;
+    struct screenCell *cells;
+    struct screenCell *shown;
+    int cursorY;
+    int cursorX;
+    int attr;
+};
+
+static struct screen S = {0};
+
+// forgets what the terminal shows so the next flush repaints everything
+void screenInvalidate(void) {
+    for (int i = 0; i < S.rows * S.cols; i++) {
+        S.shown[i].ch[0] = 0;
+        S.shown[i].len = 1;
+        S.shown[i].attr = ATTR_UNKNOWN;
+    }
+    S.cursorY = -1;
+    S.cursorX = -1;
+    S.attr = ATTR_UNKNOWN;
+}
+
+static void screenResize(int rows, int cols) {
+    free(S.cells);
+    free(S.shown);
+    S.rows = rows;
+    S.cols = cols;
+    S.cells = malloc(sizeof(struct screenCell) * rows * cols);
+    S.shown = malloc(sizeof(struct screenCell) * rows * cols);
+    if (S.cells == NULL || S.shown == NULL) die("malloc");
+    E.frameAllocs += 2;
+    screenInvalidate();
+}
+
+static void screenClearRow(int y) {
+    struct screenCell *cell = &S.cells[y * S.cols];
+    for (int x = 0; x < S.cols; x++) {
+        cell[x].ch[0] = ' ';
+        cell[x].len = 1;
+        cell[x].attr = 0;
+    }
+}
+
+static void screenPut(int y, int x, char ch, unsigned char attr) {
+    if (x < 0 || x >= S.cols) return;
+    S.cells[y * S.cols + x].ch[0] = ch;
+    S.cells[y * S.cols + x].len = 1;
+    S.cells[y * S.cols + x].attr = attr;
+}
 
-        saveTimes--;
+// puts the len byte character s, `width` columns wide, at x
+static void screenPutChar(int y, int x, const char *s, int len, int width, unsigned char attr) {
+    if (x < 0 || x >= S.cols) return;
+    // half a wide character can't be shown
+    if (width == 2 && x + 1 == S.cols) {
+        screenPut(y, x, ' ', attr);
         return;
     }
-
-    int len;
-    char *buf = editorRowToString(&len);
-
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
-        }
-        close(fd);
+    struct screenCell *cell = &S.cells[y * S.cols + x];
+    memcpy(cell->ch, s, len);
+    cell->len = len;
+    cell->attr = attr;
+    if (width == 2) {
+        cell[1].len = 0;
+        cell[1].attr = attr;
     }
+}
 
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+// draws a combining mark over the character at x
+static void screenAddMark(int y, int x, const char *s, int len) {
+    if (x < 0 || x >= S.cols) return;
+    struct screenCell *cell = &S.cells[y * S.cols + x];
+    if (cell->len == 0 && x > 0) cell--;
+    if (cell->len + len > CELL_BYTES) return;
+    memcpy(&cell->ch[cell->len], s, len);
+    cell->len += len;
 }
 
-/*** find ***/
+static void screenSetAttr(int y, int x, unsigned char attr) {
+    if (x < 0 || x >= S.cols) return;
+    S.cells[y * S.cols + x].attr = attr;
+}
 
-void editorFindCallback(char *query, int key) {
-    static int lastMatch = -1;
-    static int direction = 1;
+static int screenPutString(int y, int x, const char *s, int len, unsigned char attr) {
+    int j = 0;
+    while (j < len) {
+        int cp;
+        int n = utf8Decode(&s[j], len - j, &cp);
+        int width = (cp < 0) ? 1 : utf8Width(cp);
+        if (cp < 0) {
+            screenPut(y, x, '?', attr);
+        }else if (width == 0) {
+            screenAddMark(y, x - 1, &s[j], n);
+        }else {
+            screenPutChar(y, x, &s[j], n, width, attr);
+        }
+        x += width;
+        j += n;
+    }
+    return x;
+}
 
-    static int savedHighlightLine;
-    static int *savedHighlightChar = NULL;
+static int cellEqual(const struct screenCell *a, const struct screenCell *b) {
+    return a->len == b->len && a->attr == b->attr && memcmp(a->ch, b->ch, a->len) == 0;
+}
 
-    if (savedHighlightChar) {
-        memcpy(E.row[savedHighlightLine].highlight, savedHighlightChar, E.row[savedHighlightLine].size);
-        free(savedHighlightChar);
-        savedHighlightChar = NULL;
-    }
+static int cellBlank(const struct screenCell *cell) {
+    return cell->len == 1 && cell->ch[0] == ' ' && cell->attr == 0;
+}
 
-    if (key == '\r' || key == '\x1b') {
-        lastMatch = -1;
-        direction = 1;
-        return;
-    }else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    }else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    }else {
-        lastMatch = -1;
-        direction = 1;
-    }
-
-
-    if (lastMatch == -1) {
-        direction = 1;
-    }
-    int current = lastMatch;
-    int i;
-    for (i = 0; i < E.nrRows; i++) {
-        current += direction;
-        if (current == -1) {
-            current = E.nrRows - 1;
-        }else if (current == E.nrRows) {
-            current = 0;
-        }
-        erow *row = &E.row[current];
-        char *match = strstr(row->render, query);
-        if (match) {
-            lastMatch = current;
-            E.cursorY = current;
-            E.cursorX = editorRowRxToCx(row, match - row->render);
-            E.rowOff = E.nrRows;
-
-            savedHighlightLine = current;
-            savedHighlightChar = malloc(row->rsize);
-            memcpy(savedHighlightChar, row->highlight, row->rsize);
-            memset(&row->highlight[match - row->render], HL_MATCH, strlen(query));
-            break;
-        }
+// switches the terminal from attributes `from` to `to` with one SGR
+static void screenSgr(struct abuf *ab, int from, int to) {
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "\x1b[");
+    if (from == ATTR_UNKNOWN) {
+        len += snprintf(&buf[len], sizeof(buf) - len, "0;");
+        from = 0;
+    }
+    if ((from ^ to) & ATTR_INVERSE) {
+        len += snprintf(&buf[len], sizeof(buf) - len, (to & ATTR_INVERSE) ? "7;" : "27;");
+    }
+    if ((from & ~ATTR_INVERSE) != (to & ~ATTR_INVERSE)) {
+        int fg = to & ~ATTR_INVERSE;
+        len += snprintf(&buf[len], sizeof(buf) - len, "%d;", fg ? 30 + fg : 39);
     }
+    buf[len - 1] = 'm';
+    abAppend(ab, buf, len);
 }
 
-void editorFind() {
-    int savedCursorX = E.cursorX;
-    int savedCursorY = E.cursorY;
-    int savedColOff = E.colOff;
-    int savedRowOff = E.rowOff;
+// moves the terminal cursor with the shortest sequence that gets there
+static void screenMoveTo(struct abuf *ab, int y, int x) {
+    char buf[32];
+    int len;
 
-    char *query = editorPrompt("Find: %s (use ESC/Arrows/Enter)", editorFindCallback);
-    if (query) {
-        free(query);
+    if (S.cursorY == y && S.cursorX == x) return;
+    if (S.cursorY == y && S.cursorX >= 0 && x > S.cursorX) {
+        len = snprintf(buf, sizeof(buf), "\x1b[%dC", x - S.cursorX);
+    }else if (x == 0 && S.cursorY >= 0 && S.cursorX >= 0 && y == S.cursorY + 1) {
+        len = snprintf(buf, sizeof(buf), "\r\n");
     }else {
-        E.cursorX = savedCursorX;
-        E.cursorY = savedCursorY;
-        E.colOff = savedColOff;
-        E.rowOff = savedRowOff;
+        len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
     }
+    abAppend(ab, buf, len);
+    S.cursorY = y;
+    S.cursorX = x;
 }
 
-/*** Append buffer ***/
+static void screenFlushRow(struct abuf *ab, int y, int *attr) {
+    struct screenCell *cells = &S.cells[y * S.cols];
+    struct screenCell *shown = &S.shown[y * S.cols];
+
+    int first = 0;
+    while (first < S.cols && cellEqual(&cells[first], &shown[first])) first++;
+    if (first == S.cols) return;
+    int last = S.cols - 1;
+    while (cellEqual(&cells[last], &shown[last])) last--;
+
+    // trailing blanks are cleared with one erase-to-end-of-line
+    int end = S.cols;
+    while (end > 0 && cellBlank(&cells[end - 1])) end--;
+    int stop = (last < end) ? last + 1 : end;
+
+    int x = first;
+    while (x < stop) {
+        if (cellEqual(&cells[x], &shown[x])) {
+            x++;
+            continue;
+        }
+        // a run ends once SCREEN_MAX_GAP unchanged cells follow its last change
+        int runEnd = x;
+        for (int j = x + 1; j < stop && j - runEnd <= SCREEN_MAX_GAP; j++) {
+            if (!cellEqual(&cells[j], &shown[j])) runEnd = j;
+        }
 
-struct abuf {
-    char *buf;
-    int len;
-};
+        // the right half of a wide character is written by its left half
+        if (cells[x].len == 0 && x > 0) x--;
 
-#define ABUF_INIT { NULL, 0 }
+        screenMoveTo(ab, y, x);
+        for (; x <= runEnd; x++) {
+            if (cells[x].len == 0) continue;
+            if (cells[x].attr != *attr) {
+                screenSgr(ab, *attr, cells[x].attr);
+                *attr = cells[x].attr;
+            }
+            abAppend(ab, cells[x].ch, cells[x].len);
+        }
+        if (x < S.cols && cells[x].len == 0) x++;
+        // after the last column the cursor position depends on the terminal
+        S.cursorX = (x < S.cols) ? x : -1;
+    }
 
-void abAppend(struct abuf *ab, const char *str, int len) {
-    char *new = realloc(ab -> buf, ab -> len + len);
+    if (last >= end) {
+        screenMoveTo(ab, y, (first > end) ? first : end);
+        if (*attr != 0) {
+            screenSgr(ab, *attr, 0);
+            *attr = 0;
+        }
+        abAppend(ab, "\x1b[K", 3);
+    }
 
-    if (new == NULL) return;
-    memcpy(&new[ab -> len], str, len);
-    ab -> buf = new;
-    ab -> len += len;
+    memcpy(shown, cells, sizeof(struct screenCell) * S.cols);
 }
 
-void abFree(struct abuf *ab) {
-    free(ab -> buf);
+// appends the escape sequences that turn `shown` into `cells`
+void screenFlush(struct abuf *ab, int cursorY, int cursorX) {
+    // hide the cursor while redrawing, dropped again if nothing changed
+    int start = ab -> len;
+    abAppend(ab, "\x1b[?25l", 6);
+    int changed = ab -> len;
+
+    for (int y = 0; y < S.rows; y++) {
+        screenFlushRow(ab, y, &S.attr);
+    }
+
+    if (ab -> len == changed) {
+        ab -> len = start;
+        screenMoveTo(ab, cursorY, cursorX);
+        return;
+    }
+    if (S.attr != 0) {
+        screenSgr(ab, S.attr, 0);
+        S.attr = 0;
+    }
+    screenMoveTo(ab, cursorY, cursorX);
+    abAppend(ab, "\x1b[?25h", 6);
 }
 
 /*** Output ***/
 
 void editorScroll() {
-    E.rx = 0;
-    if (E.cursorY < E.nrRows) {
-        E.rx = editorRowCxToRx(&E.row[E.cursorY], E.cursorX);
+    E.buf->rx = 0;
+    if (E.buf->cursorY < E.buf->nrRows) {
+        E.buf->rx = editorRowCxToRx(editorRowAt(E.buf->cursorY), E.buf->cursorX);
+    }
+
+    if (E.buf->cursorY < E.buf->rowOff) {
+        E.buf->rowOff = E.buf->cursorY;
+    }
+    if (E.buf->cursorY >= E.buf->rowOff + E.screenrows) {
+        E.buf->rowOff = E.buf->cursorY - E.screenrows + 1;
+    }
+    if (E.buf->rx < E.buf->colOff) {
+        E.buf->colOff = E.buf->rx;
     }
+    if (E.buf->rx >= E.buf->colOff + E.screencols) {
+        E.buf->colOff = E.buf->rx - E.screencols + 1;
+    }
+}
+
+// colors every occurrence of the find query in a drawn row
+static void editorDrawMatches(int y, erow *row) {
+    if (!editorFindActive()) return;
+
+    size_t at = 0, start, end;
+    while (at <= (size_t)row->size && editorFindInLine(row->chars, row->size, at, &start, &end)) {
+        int rx = editorRowCxToRx(row, start) - E.buf->colOff;
+        if (rx >= E.screencols) break;
+        int rxEnd = editorRowCxToRx(row, end) - E.buf->colOff;
+        for (int j = rx; j < rxEnd; j++) {
+            screenSetAttr(y, j, editorSyntaxToColor(HL_MATCH) - 30);
+        }
+        at = (end > start) ? end : end + 1;
+    }
+}
+
+static unsigned char editorHighlightAttr(unsigned char hl) {
+    return (hl == HL_NORMAL) ? 0 : editorSyntaxToColor(hl) - 30;
+}
 
-    if (E.cursorY < E.rowOff) {
-        E.rowOff = E.cursorY;
+/* Draws a plain ASCII row from column colOff on, a byte a column. The row
+ * goes by in runs, each span and each plain gap between spans, so the
+ * attribute is worked out once per run. */
+static void editorDrawRowAscii(int y, erow *row) {
+    int len = row->rsize - E.buf->colOff;
+    if (len <= 0) {
+        return;
     }
-    if (E.cursorY >= E.rowOff + E.screenrows) {
-        E.rowOff = E.cursorY - E.screenrows + 1;
+    if (len > E.screencols) {
+        len = E.screencols;
     }
-    if (E.rx < E.colOff) {
-        E.colOff = E.rx;
+    char *c = &row->render[E.buf->colOff];
+    int k = editorRowHlFrom(row, E.buf->colOff);
+    int j = 0;
+    while (j < len) {
+        int end = len;
+        unsigned char attr = 0;
+        if (k < row->nrHl) {
+            int start = row->hl[k].start - E.buf->colOff;
+            if (start > j) {
+                if (start < end) end = start;
+            }else {
+                int spanEnd = start + row->hl[k].len;
+                if (spanEnd < end) end = spanEnd;
+                attr = editorHighlightAttr(row->hl[k].hl);
+                k++;
+            }
+        }
+        for (; j < end; j++) {
+            if (iscntrl((unsigned char)c[j])) {
+                char sym = (c[j] >= 0 && c[j] <= 26) ? '@' + c[j] : '?';
+                screenPut(y, j, sym, ATTR_INVERSE);
+            }else {
+                screenPut(y, j, c[j], attr);
+            }
+        }
     }
-    if (E.rx >= E.colOff + E.screencols) {
-        E.colOff = E.rx - E.screencols + 1;
+}
+
+// draws a row with multibyte characters from column colOff on
+static void editorDrawRowUtf8(int y, erow *row) {
+    int at = editorRowRenderAtCol(row, E.buf->colOff);
+    int k = editorRowHlFrom(row, at);
+    while (at < row->rsize) {
+        int x = row->renderCols[at] - E.buf->colOff;
+        if (x >= E.screencols) break;
+
+        const char *c = &row->render[at];
+        while (k < row->nrHl && row->hl[k].start + (int)row->hl[k].len <= at) k++;
+        unsigned char attr = (k < row->nrHl && row->hl[k].start <= at) ? editorHighlightAttr(row->hl[k].hl) : 0;
+        int cp;
+        int len = utf8Decode(c, row->rsize - at, &cp);
+        int width = row->renderCols[at + len] - row->renderCols[at];
+        if (cp < 0 || (cp >= 0x7f && cp < 0xa0)) {
+            screenPut(y, x, '?', ATTR_INVERSE);
+        }else if (cp < 0x20) {
+            screenPut(y, x, (cp <= 26) ? '@' + cp : '?', ATTR_INVERSE);
+        }else if (width == 0) {
+            screenAddMark(y, x - 1, c, len);
+        }else {
+            screenPutChar(y, x, c, len, width, attr);
+        }
+        at += len;
     }
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows(void) {
+    erow *row = editorRowAt(E.buf->rowOff);
     for (int y = 0; y < E.screenrows; y++) {
-        int fileRow = y + E.rowOff;
-        if (fileRow >= E.nrRows) {
-            if (E.nrRows == 0 && y == E.screenrows / 3) {
+        screenClearRow(y);
+        if (row == NULL) {
+            if (E.buf->nrRows == 0 && y == E.screenrows / 3) {
                 char welcome[80];
                 int welcomeLen = snprintf(welcome, sizeof(welcome),
                     "Text Editor -- version %s", EDITOR_VERSION);
                 if (welcomeLen > E.screencols) welcomeLen = E.screencols;
                 int padding = (E.screencols - welcomeLen) / 2;
                 if (padding) {
-                    abAppend(ab, "~", 1);
-                    padding--;
+                    screenPut(y, 0, '~', 0);
                 }
-                while (padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomeLen);
+                screenPutString(y, padding, welcome, welcomeLen, 0);
             }else {
-                abAppend(ab, "~", 1);
+                screenPut(y, 0, '~', 0);
             }
         }else {
-            int len = E.row[fileRow].rsize - E.colOff;
-            if (len < 0) {
-                len = 0;
-            }
-            if (len > E.screencols) {
-                len = E.screencols;
-            }
-            char *c = &E.row[fileRow].render[E.colOff];
-            unsigned char *hl = &E.row[fileRow].highlight[E.colOff];
-            int currentColor = -1;
-            int j;
-            for (j = 0; j < len; j++) {
-                if (iscntrl(c[j])) {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    if (currentColor == -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", currentColor);
-                        abAppend(ab, buf, clen);
-                    }
-                }else if (hl[j] == HL_NORMAL) {
-                    if (currentColor != -1) {
-                        abAppend(ab, "\x1b[39m", 5);
-                        currentColor = -1;
-                    }
-                    abAppend(ab, &c[j], 1);
-                }else {
-                    int color = editorSyntaxToColor(hl[j]);
-                    if (color != currentColor) {
-                        currentColor = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, &c[j], 1);
-                }
+            editorSyntaxEnsure(row);
+            if (row->renderCols) {
+                editorDrawRowUtf8(y, row);
+            }else {
+                editorDrawRowAscii(y, row);
             }
-            abAppend(ab, "\x1b[39m", 5);
+            editorDrawMatches(y, row);
+            row = editorRowNext(row);
         }
-
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
     }
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[7m", 4);
+void editorDrawStatusBar(void) {
+    int y = E.screenrows;
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Filename]", E.nrRows, E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax -> fileType : "no fit", E.cursorY + 1, E.nrRows);
+    char which[32] = "";
+    if (E.nrBuffers > 1) snprintf(which, sizeof(which), "[%d/%d] ", editorBufferIndex() + 1, E.nrBuffers);
+    int len = snprintf(status, sizeof(status), "%s%.20s - %d%s lines %s", which, E.buf->filename ? E.buf->filename : "[No Filename]", E.buf->nrRows, editorMapIndexing() ? "+" : "", E.buf->readOnly ? "(read-only)" : E.buf->dirty ? "(modified)" : "");
+    int rlen;
+    if (perfHud()) {
+        // the HUD takes the right side and cuts the file name short for it
+        rlen = perfHudText(rstatus, sizeof(rstatus));
+        if (len + rlen + 1 > E.screencols) len = E.screencols - rlen - 1;
+        if (len < 0) len = 0;
+    }else {
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.buf->syntax ? E.buf->syntax -> fileType : "no fit", E.buf->cursorY + 1, E.buf->nrRows);
+    }
     if (len > E.screencols) {
         len = E.screencols;
     }
-    abAppend(ab, status, len);
-
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-        }else {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+    for (int x = 0; x < E.screencols; x++) {
+        screenPut(y, x, ' ', ATTR_INVERSE);
+    }
+    screenPutString(y, 0, status, len, ATTR_INVERSE);
+    if (len + rlen <= E.screencols) {
+        screenPutString(y, E.screencols - rlen, rstatus, rlen, ATTR_INVERSE);
     }
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
 }
 
-void editorDrawMessageBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar(void) {
+    int y = E.screenrows + 1;
+    screenClearRow(y);
     int msgLen = strlen(E.statusMSG);
     if (msgLen > E.screencols) {
         msgLen = E.screencols;
     }
-    if (msgLen && time(NULL) - E.statusMsgTime < 5) {
-        abAppend(ab, E.statusMSG, msgLen);
+    if (msgLen) {
+        screenPutString(y, 0, E.statusMSG, msgLen, 0);
     }
 }
 
 void editorRefreshScreen() {
     editorScroll();
+    editorPagerTrim();
 
-    struct abuf ab = ABUF_INIT;
-
-    abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
-
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
-
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cursorY - E.rowOff) + 1, (E.rx - E.colOff) + 1);
-    abAppend(&ab, buf, strlen(buf));
-
-    abAppend(&ab, "\x1b[?25h", 6);
+    if (S.rows != E.screenrows + 2 || S.cols != E.screencols) {
+        screenResize(E.screenrows + 2, E.screencols);
+    }
 
-    write(STDOUT_FILENO, ab.buf, ab.len);
-    abFree(&ab);
+    perfPush(PERF_DRAW);
+    editorDrawRows();
+    perfPop();
+    editorDrawStatusBar();
+    editorDrawMessageBar();
+
+    static struct abuf frame = ABUF_INIT;
+    abReset(&frame);
+    perfPush(PERF_DIFF);
+    screenFlush(&frame, E.buf->cursorY - E.buf->rowOff, E.buf->rx - E.buf->colOff);
+    perfPop();
+
+    perfPush(PERF_WRITE);
+    abWrite(&frame, STDOUT_FILENO);
+    perfPop();
+    E.frames++;
+    E.frameBytes = frame.len;
+    E.bytesWritten += frame.len;
+    perfFrameEnd(frame.len);
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -846,6 +3602,11 @@ void editorSetStatusMessage(const char *fmt, ...) {
     vsnprintf(E.statusMSG, sizeof(E.statusMSG), fmt, ap);
     va_end(ap);
     E.statusMsgTime = time(NULL);
+    editorTimerArm(TIMER_STATUS_MSG, STATUS_MSG_TIMEOUT);
+}
+
+static void editorStatusMessageExpired(void) {
+    E.statusMSG[0] = '\0';
 }
 
 /*** Input ***/
@@ -863,9 +3624,9 @@ char *editorPrompt(char *prompt, void(*callback)(char *, int)) {
 
         int c = editorReadKey();
         if (c == DELETE_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
-            if (bufLen != 0) {
-                buf[--bufLen] = '\0';
-            }
+            // drop the whole last character, not just its last byte
+            while (bufLen != 0 && !utf8IsStartByte(buf[--bufLen])) {}
+            buf[bufLen] = '\0';
         }
         else if (c == '\x1b') {
             editorSetStatusMessage("");
@@ -882,7 +3643,21 @@ char *editorPrompt(char *prompt, void(*callback)(char *, int)) {
                 }
                 return buf;
             }
-        }else if (!iscntrl(c) && c < 128) {
+        }else if (c == PASTE_START) {
+            // only the first line of a paste fits in the prompt
+            size_t len;
+            char *text = editorReadPaste(&len);
+            len = editorLineEnd(text, text + len) - text;
+            if (bufLen + len >= bufSize) {
+                while (bufLen + len >= bufSize) bufSize *= 2;
+                buf = realloc(buf, bufSize);
+            }
+            for (size_t j = 0; j < len; j++) {
+                if (!iscntrl((unsigned char)text[j])) buf[bufLen++] = text[j];
+            }
+            buf[bufLen] = '\0';
+            free(text);
+        }else if (c < 256 && !iscntrl(c)) {
             if (bufLen == bufSize - 1) {
                 bufSize *= 2;
                 buf = realloc(buf, bufSize);
@@ -897,65 +3672,146 @@ char *editorPrompt(char *prompt, void(*callback)(char *, int)) {
 }
 
 void editorMoveCursor(int key) {
-    erow *row = (E.cursorY >= E.nrRows) ? NULL : &E.row[E.cursorY];
+    erow *row = editorRowAt(E.buf->cursorY);
     switch (key) {
         case ARROW_LEFT:
-            if (E.cursorX != 0) {
-                E.cursorX--;
-            }else if (E.cursorY > 0) {
-                E.cursorY--;
-                E.cursorX = E.row[E.cursorY].size;
+            if (E.buf->cursorX != 0) {
+                E.buf->cursorX = utf8PrevCharIndex(row, E.buf->cursorX);
+            }else if (E.buf->cursorY > 0) {
+                E.buf->cursorY--;
+                E.buf->cursorX = editorRowAt(E.buf->cursorY)->size;
             }
             break;
         case ARROW_RIGHT:
-            if (row && E.cursorX < row->size) {
-                E.cursorX++;
+            if (row && E.buf->cursorX < row->size) {
+                E.buf->cursorX = utf8NextCharIndex(row, E.buf->cursorX);
             }
-            else if (row && E.cursorX == row->size) {
-                E.cursorY++;
-                E.cursorX = 0;
+            else if (row && E.buf->cursorX == row->size && !(E.buf->cursorY == E.buf->nrRows - 1 && editorMapIndexing())) {
+                E.buf->cursorY++;
+                E.buf->cursorX = 0;
             }
             break;
         case ARROW_UP:
-            if (E.cursorY != 0) {
-                E.cursorY--;
+            if (E.buf->cursorY != 0) {
+                E.buf->cursorY--;
             }
             break;
         case ARROW_DOWN:
-            if (E.cursorY < E.nrRows) {
-                E.cursorY++;
+            // the end of a file that is still being indexed isn't known yet
+            if (E.buf->cursorY < E.buf->nrRows - (editorMapIndexing() ? 1 : 0)) {
+                E.buf->cursorY++;
             }
             break;
     }
 
-    row = (E.cursorY >= E.nrRows) ? NULL : &E.row[E.cursorY];
+    row = editorRowAt(E.buf->cursorY);
     int rowLen = row ? row->size : 0;
-    if (E.cursorX > rowLen) {
-        E.cursorX = rowLen;
+    if (E.buf->cursorX > rowLen) {
+        E.buf->cursorX = rowLen;
+    }
+    if (row && row->renderCols) {
+        E.buf->cursorX = utf8CharStart(row, E.buf->cursorX);
+    }
+}
+
+static int editorKeyTyped(int key) {
+    return key == '\t' || (key < ARROW_LEFT && key != BACKSPACE && !iscntrl((unsigned char)key));
+}
+
+static int editorKeyDeletes(int key) {
+    return key == BACKSPACE || key == CTRL_KEY('h') || key == DELETE_KEY;
+}
+
+// a run of typed characters, or of deletions, is undone in one step
+static int editorUndoExtends(int lastKey, int key) {
+    return (editorKeyTyped(key) && editorKeyTyped(lastKey))
+        || (editorKeyDeletes(key) && editorKeyDeletes(lastKey));
+}
+
+// the rest of a typed multibyte character comes right behind its first
+// byte; it is inserted in one piece so a row never holds half of one
+static void editorInsertTyped(int c) {
+    char ch[4] = { c };
+    int len = utf8CharLen((unsigned char *)ch);
+    int got = 1;
+    while (got < len && editorInputBuffered() && !utf8IsStartByte(In.buf[In.start])) {
+        editorInputByte(&ch[got++]);
     }
+    editorInsertText(ch, got);
 }
 
 void editorProcessKeypress() {
     static int quitTimes = QUIT_TIMES;
     static int saveTimes = SAVE_TIMES;
 
+    static int lastKey = 0;
+
     int c = editorReadKey();
+    perfPush(PERF_EDIT);
+    if (E.buf->readOnly && (c = editorPagerKey(c)) == 0) {
+        perfPop();
+        return;
+    }
+    if (!editorUndoExtends(lastKey, c)) editorUndoSeal();
+    lastKey = c;
+
     switch (c) {
         case '\r':
             editorInsertNewLine();
             break;
 
-        case CTRL_KEY('q'):
-            if (E.dirty && quitTimes > 0) {
-                editorSetStatusMessage("WARNING!!!!! File has unsaved changes. "
-                                       "Press CTRL-Q %d more times to quit", quitTimes);
+        case PASTE_START: {
+            size_t len;
+            char *text = editorReadPaste(&len);
+            editorInsertText(text, len);
+            free(text);
+            break;
+        }
+
+        case CTRL_KEY('z'):
+            if (!editorUndo()) editorSetStatusMessage("Nothing to undo");
+            break;
+
+        case CTRL_KEY('y'):
+            if (!editorRedo()) editorSetStatusMessage("Nothing to redo");
+            break;
+
+        case CTRL_KEY('q'): {
+            int dirty = editorBuffersDirty();
+            if (dirty && quitTimes > 0) {
+                if (dirty == 1) {
+                    editorSetStatusMessage("WARNING!!!!! File has unsaved changes. "
+                                           "Press CTRL-Q %d more times to quit", quitTimes);
+                }else {
+                    editorSetStatusMessage("WARNING!!!!! %d files have unsaved changes. "
+                                           "Press CTRL-Q %d more times to quit", dirty, quitTimes);
+                }
                 quitTimes--;
+                perfPop();
                 return;
             }
+            editorSaveWait();
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
             exit(0);
             break;
+        }
+
+        case CTRL_KEY('o'):
+            editorBufferPrompt();
+            break;
+
+        case CTRL_KEY('n'):
+            editorBufferStep(1);
+            break;
+
+        case CTRL_KEY('p'):
+            editorBufferStep(-1);
+            break;
+
+        case CTRL_KEY('w'):
+            editorBufferCloseShown();
+            break;
 
         case CTRL_KEY('s'):
 
@@ -963,17 +3819,27 @@ void editorProcessKeypress() {
             break;
 
         case HOME_KEY:
-            E.cursorX = 0;
+            E.buf->cursorX = 0;
             break;
 
         case END_KEY:
-            E.cursorX = E.row[E.cursorY].size;
+            if (E.buf->cursorY < E.buf->nrRows) {
+                E.buf->cursorX = editorRowAt(E.buf->cursorY)->size;
+            }
             break;
 
         case CTRL_KEY('f'):
             editorFind();
             break;
 
+        case CTRL_KEY('r'):
+            editorMemorySummary();
+            break;
+
+        case CTRL_KEY('g'):
+            editorGoToLine();
+            break;
+
         case BACKSPACE:
         case CTRL_KEY('h'):
         case DELETE_KEY:
@@ -985,12 +3851,15 @@ void editorProcessKeypress() {
         case PAGE_DOWN: {
 
             if (c == PAGE_UP) {
-                E.cursorY = E.rowOff;
+                E.buf->cursorY = E.buf->rowOff;
             }
             else if (c == PAGE_DOWN) {
-                E.cursorY = E.rowOff + E.screenrows - 1;
-                if (E.cursorY > E.nrRows) {
-                    E.cursorY = E.nrRows;
+                E.buf->cursorY = E.buf->rowOff + E.screenrows - 1;
+                if (E.buf->cursorY > E.buf->nrRows) {
+                    E.buf->cursorY = E.buf->nrRows;
+                }
+                if (E.buf->cursorY == E.buf->nrRows && editorMapIndexing()) {
+                    E.buf->cursorY--;
                 }
             }
 
@@ -1013,9 +3882,280 @@ void editorProcessKeypress() {
             break;
 
         default:
-            editorInserChar(c);
+            if (c >= 0x80) {
+                editorInsertTyped(c);
+            }else {
+                editorInserChar(c);
+            }
             break;
     }
+    perfPop();
+}
+
+/*** background work ***/
+
+static int editorInputPending(void) {
+    if (editorInputBuffered()) return 1;
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+static double editorNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Called while editorReadKey waits for a key. Does background work until a
+ * key arrives, redrawing now and then to show progress. Returns 1 if the
+ * screen needs to be redrawn. */
+int editorIdle(void) {
+    int worked = 0;
+    double lastDraw = editorNow();
+
+    if (editorFindPoll()) worked = 1;
+    if (editorSavePoll()) worked = 1;
+    if (editorFollowPoll()) worked = 1;
+
+    int highlighting = (E.buf->syntax != NULL && rowTreeFirstMarked(&E.buf->rows) != NULL);
+    while ((editorMapIndexing() || highlighting) && !editorInputPending()) {
+        if (editorMapIndexing()) {
+            editorMapIndexSlice(MAP_INDEX_SLICE);
+        }else {
+            highlighting = editorSyntaxBackground(HL_BACKGROUND_SLICE);
+        }
+        worked = 1;
+        // a find runs alongside indexing, and its first match shouldn't wait for it
+        if (editorFindPoll() || editorNow() - lastDraw > 0.1) {
+            editorRefreshScreen();
+            lastDraw = editorNow();
+        }
+    }
+    return worked;
+}
+
+/*** event loop ***/
+
+/* Waiting for a key blocks in poll on the terminal, on a wake pipe and,
+ * with -F, on inotify. The pipe is written by the SIGWINCH handler and by
+ * the find and save threads when they have something to show, so nothing
+ * has to wake up on a clock to look; timers cover what has to happen at a
+ * given time. */
+
+static int wakePipe[2] = { -1, -1 };
+static volatile sig_atomic_t resized = 0;
+
+static struct {
+    double at;
+    void (*fire)(void);
+} timers[NR_TIMERS] = {
+    [TIMER_STATUS_MSG] = { 0, editorStatusMessageExpired },
+    [TIMER_SAVE_PROGRESS] = { 0, editorSaveProgress },
+    [TIMER_FOLLOW] = { 0, editorFollowRetry },
+};
+
+// (re)arms a timer to fire once, delay seconds from now
+static void editorTimerArm(int timer, double delay) {
+    timers[timer].at = editorNow() + delay;
+}
+
+// fires the timers due by `now`; returns 1 if any did
+int editorTimersFire(double now) {
+    int fired = 0;
+    for (int i = 0; i < NR_TIMERS; i++) {
+        if (timers[i].at != 0 && timers[i].at <= now) {
+            timers[i].at = 0;
+            timers[i].fire();
+            fired = 1;
+        }
+    }
+    return fired;
+}
+
+// ms until the next timer is due, -1 if none is armed
+static int editorTimerTimeout(void) {
+    double next = 0;
+    for (int i = 0; i < NR_TIMERS; i++) {
+        if (timers[i].at != 0 && (next == 0 || timers[i].at < next)) next = timers[i].at;
+    }
+    if (next == 0) return -1;
+    double ms = (next - editorNow()) * 1000;
+    return (ms <= 0) ? 0 : (int)ms + 1;
+}
+
+// wakes the event loop from another thread or a signal handler
+void editorWake(void) {
+    if (wakePipe[1] != -1) {
+        char c = 0;
+        if (write(wakePipe[1], &c, 1) == -1) {
+            // the pipe is full, so the loop is woken already
+        }
+    }
+}
+
+void editorEventsInit(void) {
+    if (pipe(wakePipe) == -1) die("pipe");
+    for (int i = 0; i < 2; i++) {
+        fcntl(wakePipe[i], F_SETFL, fcntl(wakePipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wakePipe[i], F_SETFD, FD_CLOEXEC);
+    }
+}
+
+static int editorHandleResize(void) {
+    if (!resized) return 0;
+    resized = 0;
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) return 0;
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+    return 1;
+}
+
+/* Runs until there is input to read: background work, timers and resizes
+ * are handled as they come, and the screen is redrawn when one of them
+ * changed it. */
+static void editorWaitForInput(void) {
+    while (!editorInputBuffered()) {
+        int redraw = editorHandleResize();
+        if (editorTimersFire(editorNow())) redraw = 1;
+        perfPush(PERF_IDLE);
+        if (editorIdle()) redraw = 1;
+        perfPop();
+        if (redraw) editorRefreshScreen();
+
+        // editorIdle only returns with work left when input is pending
+        // followFd is -1 without -F, which poll skips
+        struct pollfd pfd[3] = {
+            { STDIN_FILENO, POLLIN, 0 },
+            { wakePipe[0], POLLIN, 0 },
+            { followFd, POLLIN, 0 },
+        };
+        perfPush(PERF_WAIT);
+        int ready = poll(pfd, 3, editorTimerTimeout());
+        perfPop();
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        if (pfd[1].revents & POLLIN) {
+            char drain[64];
+            while (read(wakePipe[0], drain, sizeof(drain)) > 0);
+        }
+        if (pfd[0].revents & (POLLIN | POLLHUP)) {
+            if (editorInputFill(0) == 0 && (In.eof || (pfd[0].revents & POLLHUP))) editorInputEnded();
+        }
+    }
+}
+
+/* Handles a key and every key already waiting behind it, then draws one
+ * frame for all of them, so key repeat or typing over a slow link doesn't
+ * cost a frame per key. */
+void editorProcessInput(void) {
+    do {
+        editorProcessKeypress();
+    } while (editorInputPending());
+    editorRefreshScreen();
+}
+
+/*** replay ***/
+
+/* A replay feeds a file of recorded keys through the same input path a
+ * terminal would, on a screen of a given size and without raw mode, and
+ * times every key from reading it to the end of the frame it caused. */
+
+static struct {
+    int active;
+    double *latency;
+    int nrKeys;
+    int cap;
+    double started;
+} R;
+
+void editorReplayBegin(int rows, int cols) {
+    R.active = 1;
+    R.nrKeys = 0;
+    R.started = editorNow();
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+}
+
+// handles the next key and draws its frame; returns 0 once the keys are used up
+int editorReplayStep(void) {
+    if (!editorInputBuffered() && editorInputFill(0) == 0) {
+        // a save the last keys started still has to land, as on CTRL-Q
+        editorSaveWait();
+        return 0;
+    }
+
+    double start = editorNow();
+    editorProcessKeypress();
+    editorRefreshScreen();
+    double elapsed = editorNow() - start;
+
+    if (R.nrKeys == R.cap) {
+        R.cap = R.cap ? R.cap * 2 : 1024;
+        R.latency = realloc(R.latency, sizeof(double) * R.cap);
+        if (R.latency == NULL) die("realloc");
+    }
+    R.latency[R.nrKeys++] = elapsed;
+
+    // results from the find and save threads land between keys, untimed
+    editorFindPoll();
+    editorSavePoll();
+    return 1;
+}
+
+static int editorCompareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of the sorted latencies, in microseconds
+static double editorReplayPercentile(double p) {
+    int rank = (int)(p / 100 * R.nrKeys + 0.999999);
+    if (rank < 1) rank = 1;
+    return R.latency[rank - 1] * 1e6;
+}
+
+// writes the latency percentiles and a histogram with power of two buckets
+void editorReplayReport(int fd) {
+    if (R.nrKeys == 0) {
+        dprintf(fd, "replay: no keys\n");
+        return;
+    }
+    qsort(R.latency, R.nrKeys, sizeof(double), editorCompareDoubles);
+    double total = 0;
+    for (int i = 0; i < R.nrKeys; i++) total += R.latency[i];
+
+    dprintf(fd, "replay: %d keys in %.3f s, %ld frames, %lld bytes out\n", R.nrKeys,
+            editorNow() - R.started, E.frames, E.bytesWritten);
+    dprintf(fd, "latency us: mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+            total / R.nrKeys * 1e6, editorReplayPercentile(50), editorReplayPercentile(90),
+            editorReplayPercentile(99), R.latency[R.nrKeys - 1] * 1e6);
+
+    int i = 0;
+    for (double bound = 1; i < R.nrKeys; bound *= 2) {
+        int count = 0;
+        while (i < R.nrKeys && R.latency[i] * 1e6 < bound) {
+            count++;
+            i++;
+        }
+        if (count == 0) continue;
+        char bar[41];
+        int len = (int)((long long)count * 40 / R.nrKeys);
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        dprintf(fd, "  < %8.0f us %8d %s\n", bound, count, bar);
+    }
+}
+
+// the keys ran out: a replay is over, a terminal has hung up
+static void editorInputEnded(void) {
+    if (R.active) {
+        editorSaveWait();
+        exit(0);
+    }
+    die("read");
 }
 
 /*** signals ***/
@@ -1030,7 +4170,21 @@ void handelSignal(int sig) {
     exit(1);
 }
 
+static void handleResize(int sig) {
+    (void)sig;
+    int savedErrno = errno;
+    resized = 1;
+    editorWake();
+    errno = savedErrno;
+}
+
 void setupSignalHandler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleResize;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+
     signal(SIGINT, handelSignal);
     signal(SIGTERM, handelSignal);
     signal(SIGSEGV, handelSignal);
@@ -1039,19 +4193,12 @@ void setupSignalHandler() {
 /*** init/main function ***/
 
 void initEditor() {
-    E.cursorX = 0;
-    E.cursorY = 0;
-    E.rx = 0;
-    E.rowOff = 0;
-    E.colOff = 0;
-    E.nrRows = 0;
-    E.row = NULL;
-    E.dirty = 0;
-    E.filename = NULL;
+    editorBufferNew();
     E.statusMSG[0] = '\0';
     E.statusMsgTime = 0;
-    E.syntax = NULL;
 
+    // a replay has its size from the command line and no terminal to ask
+    if (R.active) return;
     if (getWindowSize(&E.screenrows, &E.screencols) == -1) {
         die("getWindowSize");
     }
@@ -1059,19 +4206,106 @@ void initEditor() {
 }
 
 #ifndef TEST_BUILD
+static int reportFd = -1;
+static const char *tracePath = NULL;
+static int memoryReport = 0;
+
+static void editorTraceAtExit(void) {
+    if (perfWriteTrace(tracePath) == -1) perror(tracePath);
+}
+
+static void editorMemoryAtExit(void) {
+    editorMemoryReport(STDERR_FILENO);
+}
+
+static void editorReplayAtExit(void) {
+    editorReplayReport(reportFd);
+}
+
+/* Sets up a headless run: the keys file becomes stdin and the frames go to
+ * the capture file or /dev/null, while the report goes to the real stdout.
+ * The run ends with the keys or with CTRL-Q, through exit() either way. */
+static void editorReplaySetup(const char *keys, const char *size, const char *capture) {
+    int rows = 24, cols = 80;
+    if (size && (sscanf(size, "%dx%d", &rows, &cols) != 2 || rows < 3 || cols < 1)) {
+        fprintf(stderr, "bad --size '%s', expected ROWSxCOLS\n", size);
+        exit(2);
+    }
+
+    int in = open(keys, O_RDONLY);
+    if (in == -1 || dup2(in, STDIN_FILENO) == -1) die(keys);
+    close(in);
+
+    int out = open(capture ? capture : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    reportFd = dup(STDOUT_FILENO);
+    if (out == -1 || reportFd == -1 || dup2(out, STDOUT_FILENO) == -1) die("replay output");
+    close(out);
+
+    editorReplayBegin(rows, cols);
+    atexit(editorReplayAtExit);
+}
+
 int main(int argc, char *argv[]) {
-    enableRawMode();
-    setupSignalHandler();
+    const char *keys = NULL, *size = NULL, *capture = NULL;
+    char **filenames = calloc(argc, sizeof(char *));
+    int nrFilenames = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            keys = argv[++i];
+        }else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = argv[++i];
+        }else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture = argv[++i];
+        }else if (strcmp(argv[i], "--mem-report") == 0) {
+            memoryReport = 1;
+        }else if (strcmp(argv[i], "-R") == 0) {
+            E.pager = 1;
+        }else if (strcmp(argv[i], "-F") == 0) {
+            E.follow = 1;
+        }else if (strcmp(argv[i], "--hud") == 0) {
+            perfEnable(1, 0);
+        }else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+            perfEnable(0, 1);
+        }else {
+            filenames[nrFilenames++] = argv[i];
+        }
+    }
+
+    // atexit runs handlers last to first, so these run once raw mode,
+    // registered after them, has restored the terminal
+    if (tracePath) atexit(editorTraceAtExit);
+    if (memoryReport) atexit(editorMemoryAtExit);
+    if (keys) {
+        editorReplaySetup(keys, size, capture);
+    }else {
+        enableRawMode();
+    }
+    editorEventsInit();
+    if (!keys) setupSignalHandler();
     initEditor();
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    for (int i = 0; i < nrFilenames; i++) {
+        editorBufferOpen(filenames[i]);
     }
+    if (nrFilenames > 1) editorBufferSwitch(0);
+    free(filenames);
 
-    editorSetStatusMessage("HELP: CTRL-S = save | CTRL-Q = quit | CTRL-F = find");
+    // a file that couldn't be opened says so instead
+    if (!E.statusMSG[0]) {
+        if (E.pager) {
+            editorSetStatusMessage("HELP: q = quit | space/b = page | g/G = top/end | / = find | %% = go to");
+        }else {
+            editorSetStatusMessage("HELP: CTRL-S = save | CTRL-Q = quit | CTRL-F = find | CTRL-G = go to | CTRL-Z/Y = undo/redo");
+        }
+    }
 
+    editorRefreshScreen();
+    if (keys) {
+        while (editorReplayStep());
+        exit(0);
+    }
     while (1) {
-        editorRefreshScreen();
-        editorProcessKeypress();
+        editorProcessInput();
     }
     return 0;
 }
@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/perf.h"
+
+#define PERF_DEPTH 32
+
+static const char *phaseNames[PERF_PHASES] = {
+    "other", "input", "edit", "syntax", "drawRows", "diff", "write", "wait", "idle"
+};
+
+// a finished phase, or a whole frame when phase is PERF_PHASES
+struct perfEvent {
+    double start;
+    double dur;
+    size_t bytes;
+    int phase;
+};
+
+struct perfFrame {
+    double total;
+    double phases[PERF_PHASES];
+    size_t bytes;
+};
+
+int perfOn = 0;
+
+static struct {
+    int hud;
+    int trace;
+    double epoch;
+
+    int stack[PERF_DEPTH];
+    double began[PERF_DEPTH];
+    int depth;
+    int outside;
+    double last;
+
+    double frameStart;
+    double charge[PERF_PHASES];
+    struct perfFrame history[PERF_HISTORY];
+    int frames;
+
+    struct perfEvent *events;
+    int nrEvents;
+    int cap;
+    long dropped;
+} P;
+
+static double perfNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void perfEnable(int hud, int trace) {
+    if (!perfOn) P.epoch = P.last = perfNow();
+    P.hud |= hud;
+    P.trace |= trace;
+    perfOn = P.hud || P.trace;
+}
+
+int perfHud(void) {
+    return P.hud;
+}
+
+static int perfExcluded(int phase) {
+    return phase == PERF_WAIT || phase == PERF_IDLE;
+}
+
+// gives the time since the last charge to the phase on top
+static void perfCharge(double now) {
+    if (P.outside == 0) {
+        int top = P.depth ? P.stack[(P.depth < PERF_DEPTH ? P.depth : PERF_DEPTH) - 1] : PERF_OTHER;
+        if (P.frameStart == 0) P.frameStart = P.last;
+        P.charge[top] += now - P.last;
+    }
+    P.last = now;
+}
+
+static void perfRecord(int phase, double start, double dur, size_t bytes) {
+    if (!P.trace) return;
+    if (P.nrEvents == PERF_MAX_EVENTS) {
+        P.dropped++;
+        return;
+    }
+    if (P.nrEvents == P.cap) {
+        P.cap = P.cap ? P.cap * 2 : 4096;
+        P.events = realloc(P.events, sizeof(struct perfEvent) * P.cap);
+        if (P.events == NULL) abort();
+    }
+    P.events[P.nrEvents++] = (struct perfEvent){ start, dur, bytes, phase };
+}
+
+// past PERF_DEPTH pushes are only counted, so pops still line up
+void perfPushSlow(int phase) {
+    double now = perfNow();
+    perfCharge(now);
+    if (P.depth < PERF_DEPTH) {
+        P.stack[P.depth] = phase;
+        P.began[P.depth] = now;
+        if (perfExcluded(phase)) P.outside++;
+    }
+    P.depth++;
+}
+
+void perfPopSlow(void) {
+    if (P.depth == 0) return;
+    double now = perfNow();
+    perfCharge(now);
+    P.depth--;
+    if (P.depth >= PERF_DEPTH) return;
+    int phase = P.stack[P.depth];
+    if (perfExcluded(phase)) P.outside--;
+    perfRecord(phase, P.began[P.depth], now - P.began[P.depth], 0);
+}
+
+void perfFrameEnd(size_t bytes) {
+    if (!perfOn) return;
+    double now = perfNow();
+    perfCharge(now);
+    // redraws made while idle are progress updates, not answers to a key
+    if (P.outside) return;
+
+    struct perfFrame *frame = &P.history[P.frames % PERF_HISTORY];
+    frame->total = 0;
+    for (int i = 0; i < PERF_PHASES; i++) {
+        frame->phases[i] = P.charge[i];
+        frame->total += P.charge[i];
+    }
+    frame->bytes = bytes;
+    P.frames++;
+
+    perfRecord(PERF_PHASES, P.frameStart, now - P.frameStart, bytes);
+    memset(P.charge, 0, sizeof(P.charge));
+    P.frameStart = 0;
+}
+
+int perfRolling(double *frame, double phases[PERF_PHASES], double *bytes) {
+    int n = P.frames < PERF_HISTORY ? P.frames : PERF_HISTORY;
+    *frame = 0;
+    *bytes = 0;
+    memset(phases, 0, sizeof(double) * PERF_PHASES);
+    if (n == 0) return 0;
+
+    for (int f = 0; f < n; f++) {
+        const struct perfFrame *h = &P.history[f];
+        *frame += h->total;
+        *bytes += h->bytes;
+        for (int i = 0; i < PERF_PHASES; i++) phases[i] += h->phases[i];
+    }
+    *frame /= n;
+    *bytes /= n;
+    for (int i = 0; i < PERF_PHASES; i++) phases[i] /= n;
+    return n;
+}
+
+int perfHudText(char *buf, size_t size) {
+    double frame, phases[PERF_PHASES], bytes;
+    int len;
+    if (perfRolling(&frame, phases, &bytes) == 0) {
+        len = snprintf(buf, size, "no frames yet");
+    }else {
+        // phase times in microseconds, which is where most of them are
+        len = snprintf(buf, size, "%.2fms in%.0f ed%.0f hl%.0f dr%.0f df%.0f wr%.0f %.1fkB",
+                       frame * 1e3, phases[PERF_INPUT] * 1e6, phases[PERF_EDIT] * 1e6,
+                       phases[PERF_SYNTAX] * 1e6, phases[PERF_DRAW] * 1e6,
+                       phases[PERF_DIFF] * 1e6, phases[PERF_WRITE] * 1e6, bytes / 1024);
+    }
+    if (len >= (int)size) len = size - 1;
+    return len;
+}
+
+/*** trace export ***/
+
+int perfWriteTrace(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) return -1;
+
+    // phases on one track, frames on a second one since a frame that ends
+    // inside a prompt doesn't nest with the keypress around it
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%ld},\"traceEvents\":[\n", P.dropped);
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"text_editor\"}},\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}},\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"frames\"}}");
+    for (int i = 0; i < P.nrEvents; i++) {
+        const struct perfEvent *ev = &P.events[i];
+        double ts = (ev->start - P.epoch) * 1e6;
+        if (ev->phase == PERF_PHASES) {
+            fprintf(fp, ",\n{\"name\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":2,"
+                        "\"args\":{\"bytes\":%zu}}", ts, ev->dur * 1e6, ev->bytes);
+            fprintf(fp, ",\n{\"name\":\"bytes out\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+                        "\"args\":{\"bytes\":%zu}}", ts + ev->dur * 1e6, ev->bytes);
+        }else {
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                    phaseNames[ev->phase], ts, ev->dur * 1e6);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
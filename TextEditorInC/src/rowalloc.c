@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/rowalloc.h"
+
+// the first bytes of a slab link it to the next one; blocks start after
+#define SLAB_HEADER 16
+
+static const size_t classSizes[ROW_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+/*** size classes ***/
+
+static int classOf(size_t size) {
+    int lo = 0, hi = ROW_CLASSES - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (classSizes[mid] < size) {
+            lo = mid + 1;
+        }else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t rowAllocSize(size_t size) {
+    if (size > ROW_SMALL_MAX) return size;
+    return classSizes[classOf(size)];
+}
+
+/*** blocks ***/
+
+static void *rowSlabCarve(struct rowHeap *heap, size_t size) {
+    if (heap->bumpLeft < size) {
+        // the tail of the old slab stays slack
+        char *slab = malloc(ROW_SLAB_SIZE);
+        if (slab == NULL) abort();
+        memcpy(slab, &heap->slabs, sizeof(void *));
+        heap->slabs = slab;
+        heap->slabBytes += ROW_SLAB_SIZE;
+        heap->bump = slab + SLAB_HEADER;
+        heap->bumpLeft = ROW_SLAB_SIZE - SLAB_HEADER;
+    }
+    void *p = heap->bump;
+    heap->bump += size;
+    heap->bumpLeft -= size;
+    return p;
+}
+
+void *rowAlloc(struct rowHeap *heap, int kind, size_t size) {
+    size = rowAllocSize(size);
+    heap->used[kind] += size;
+    heap->blocks[kind]++;
+
+    if (size > ROW_SMALL_MAX) {
+        void *p = malloc(size);
+        if (p == NULL) abort();
+        heap->largeBytes += size;
+        return p;
+    }
+
+    int c = classOf(size);
+    void *p = heap->freeList[c];
+    if (p) {
+        memcpy(&heap->freeList[c], p, sizeof(void *));
+        return p;
+    }
+    return rowSlabCarve(heap, size);
+}
+
+void rowFree(struct rowHeap *heap, int kind, void *p, size_t size) {
+    if (p == NULL) return;
+    size = rowAllocSize(size);
+    heap->used[kind] -= size;
+    heap->blocks[kind]--;
+
+    if (size > ROW_SMALL_MAX) {
+        heap->largeBytes -= size;
+        free(p);
+        return;
+    }
+    int c = classOf(size);
+    memcpy(p, &heap->freeList[c], sizeof(void *));
+    heap->freeList[c] = p;
+}
+
+void *rowRealloc(struct rowHeap *heap, int kind, void *p, size_t oldSize, size_t size) {
+    if (p == NULL) return rowAlloc(heap, kind, size);
+    size_t from = rowAllocSize(oldSize), to = rowAllocSize(size);
+    if (from == to) return p;
+
+    if (from > ROW_SMALL_MAX && to > ROW_SMALL_MAX) {
+        p = realloc(p, to);
+        if (p == NULL) abort();
+        heap->used[kind] += to - from;
+        heap->largeBytes += to - from;
+        return p;
+    }
+    void *moved = rowAlloc(heap, kind, to);
+    memcpy(moved, p, from < to ? from : to);
+    rowFree(heap, kind, p, from);
+    return moved;
+}
+
+/*** heap ***/
+
+void rowHeapRelease(struct rowHeap *heap) {
+    void *slab = heap->slabs;
+    while (slab) {
+        void *next;
+        memcpy(&next, slab, sizeof(void *));
+        free(slab);
+        slab = next;
+    }
+    memset(heap, 0, sizeof(*heap));
+}
+
+size_t rowHeapSlack(const struct rowHeap *heap) {
+    size_t small = 0;
+    for (int k = 0; k < ROW_KINDS; k++) small += heap->used[k];
+    small -= heap->largeBytes;
+    size_t slabs = heap->slabBytes / ROW_SLAB_SIZE;
+    return heap->slabBytes - slabs * SLAB_HEADER - small;
+}
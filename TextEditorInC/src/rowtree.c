@@ -0,0 +1,255 @@
+#include <stdlib.h>
+
+#include "../include/rowtree.h"
+
+/*** helpers ***/
+
+static unsigned int rowTreeSeed = 2463534242u;
+
+static unsigned int rowTreeRandom(void) {
+    rowTreeSeed ^= rowTreeSeed << 13;
+    rowTreeSeed ^= rowTreeSeed >> 17;
+    rowTreeSeed ^= rowTreeSeed << 5;
+    return rowTreeSeed;
+}
+
+static int nodeCount(const rowNode *node) {
+    return node ? node->count : 0;
+}
+
+static int nodeWeight(const rowNode *node) {
+    return node->span ? node->span : 1;
+}
+
+static int nodeMarked(const rowNode *node) {
+    return node ? node->marked : 0;
+}
+
+static void nodeUpdate(rowNode *node) {
+    node->count = nodeWeight(node) + nodeCount(node->left) + nodeCount(node->right);
+    node->marked = node->mark + nodeMarked(node->left) + nodeMarked(node->right);
+}
+
+static void setLeft(rowNode *node, rowNode *child) {
+    node->left = child;
+    if (child) child->parent = node;
+}
+
+static void setRight(rowNode *node, rowNode *child) {
+    node->right = child;
+    if (child) child->parent = node;
+}
+
+// splits t into the first `at` rows (l) and the rest (r); `at` must not
+// fall inside a span
+static void split(rowNode *t, int at, rowNode **l, rowNode **r) {
+    if (t == NULL) {
+        *l = NULL;
+        *r = NULL;
+        return;
+    }
+
+    rowNode *a, *b;
+    if (nodeCount(t->left) < at) {
+        split(t->right, at - nodeCount(t->left) - nodeWeight(t), &a, &b);
+        setRight(t, a);
+        nodeUpdate(t);
+        if (b) b->parent = NULL;
+        *l = t;
+        *r = b;
+    }else {
+        split(t->left, at, &a, &b);
+        setLeft(t, b);
+        nodeUpdate(t);
+        if (a) a->parent = NULL;
+        *l = a;
+        *r = t;
+    }
+    t->parent = NULL;
+}
+
+// joins two trees where every row of a comes before every row of b
+static rowNode *merge(rowNode *a, rowNode *b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    if (a->priority > b->priority) {
+        setRight(a, merge(a->right, b));
+        nodeUpdate(a);
+        return a;
+    }else {
+        setLeft(b, merge(a, b->left));
+        nodeUpdate(b);
+        return b;
+    }
+}
+
+/*** row tree ***/
+
+rowNode *rowTreeNewNode(void) {
+    rowNode *node = calloc(1, sizeof(rowNode));
+    if (node == NULL) return NULL;
+    node->count = 1;
+    node->priority = rowTreeRandom();
+    return node;
+}
+
+int rowTreeCount(const struct rowTree *tree) {
+    return nodeCount(tree->root);
+}
+
+rowNode *rowTreeAt(const struct rowTree *tree, int at, int *offset) {
+    rowNode *node = tree->root;
+    while (node) {
+        int leftCount = nodeCount(node->left);
+        if (at < leftCount) {
+            node = node->left;
+        }else if (at < leftCount + nodeWeight(node)) {
+            if (offset) *offset = at - leftCount;
+            return node;
+        }else {
+            at -= leftCount + nodeWeight(node);
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+int rowTreeIndexOf(const rowNode *node) {
+    int index = nodeCount(node->left);
+    while (node->parent) {
+        if (node == node->parent->right) {
+            index += nodeCount(node->parent->left) + nodeWeight(node->parent);
+        }
+        node = node->parent;
+    }
+    return index;
+}
+
+void rowTreeInsert(struct rowTree *tree, int at, rowNode *node) {
+    rowNode *l, *r;
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+    nodeUpdate(node);
+
+    split(tree->root, at, &l, &r);
+    tree->root = merge(merge(l, node), r);
+    tree->root->parent = NULL;
+}
+
+void rowTreeRemove(struct rowTree *tree, rowNode *node) {
+    rowNode *parent = node->parent;
+    rowNode *joined = merge(node->left, node->right);
+
+    if (joined) joined->parent = parent;
+    if (parent == NULL) {
+        tree->root = joined;
+    }else if (parent->left == node) {
+        parent->left = joined;
+    }else {
+        parent->right = joined;
+    }
+
+    for (; parent; parent = parent->parent) {
+        nodeUpdate(parent);
+    }
+
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+    nodeUpdate(node);
+}
+
+void rowTreeResize(rowNode *node, int span) {
+    node->span = span;
+    for (; node; node = node->parent) {
+        nodeUpdate(node);
+    }
+}
+
+static void clearNode(rowNode *node, void (*release)(rowNode *node)) {
+    if (node == NULL) return;
+    clearNode(node->left, release);
+    clearNode(node->right, release);
+    release(node);
+}
+
+void rowTreeClear(struct rowTree *tree, void (*release)(rowNode *node)) {
+    clearNode(tree->root, release);
+    tree->root = NULL;
+}
+
+void rowTreeSetMark(rowNode *node, int mark) {
+    if (node->mark == mark) return;
+    node->mark = mark;
+    for (; node; node = node->parent) {
+        nodeUpdate(node);
+    }
+}
+
+static void markNode(rowNode *node) {
+    if (node == NULL) return;
+    markNode(node->left);
+    markNode(node->right);
+    node->mark = (node->span == 0);
+    nodeUpdate(node);
+}
+
+// marks every materialized row in O(n)
+void rowTreeMarkAll(struct rowTree *tree) {
+    markNode(tree->root);
+}
+
+static void unmarkNode(rowNode *node) {
+    if (nodeMarked(node) == 0) return;
+    unmarkNode(node->left);
+    unmarkNode(node->right);
+    node->mark = 0;
+    node->marked = 0;
+}
+
+// unmarks every row, skipping subtrees with no marks
+void rowTreeClearMarks(struct rowTree *tree) {
+    unmarkNode(tree->root);
+}
+
+rowNode *rowTreeFirstMarked(const struct rowTree *tree) {
+    rowNode *node = tree->root;
+    if (nodeMarked(node) == 0) return NULL;
+
+    while (node) {
+        if (nodeMarked(node->left)) {
+            node = node->left;
+        }else if (node->mark) {
+            return node;
+        }else {
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+rowNode *rowTreeNext(rowNode *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) node = node->left;
+        return node;
+    }
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+rowNode *rowTreePrev(rowNode *node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right) node = node->right;
+        return node;
+    }
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+    return node->parent;
+}
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/substring.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SUBSTRING_X86 1
+#endif
+
+/*** engines ***/
+
+static const char *findScalar(const char *hay, size_t len, const char *needle, size_t nlen) {
+    return memmem(hay, len, needle, nlen);
+}
+
+#ifdef SUBSTRING_X86
+
+__attribute__((target("sse2")))
+static const char *findSse2(const char *hay, size_t len, const char *needle, size_t nlen) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+
+    size_t i = 0;
+    for (; i + nlen - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&hay[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&hay[i + nlen - 1]);
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(&hay[at + 1], &needle[1], nlen - 2) == 0) return &hay[at];
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(&hay[i], len - i, needle, nlen);
+}
+
+__attribute__((target("avx2")))
+static const char *findAvx2(const char *hay, size_t len, const char *needle, size_t nlen) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+
+    size_t i = 0;
+    for (; i + nlen - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&hay[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&hay[i + nlen - 1]);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(&hay[at + 1], &needle[1], nlen - 2) == 0) return &hay[at];
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(&hay[i], len - i, needle, nlen);
+}
+
+#endif
+
+typedef const char *(*findFn)(const char *, size_t, const char *, size_t);
+
+static findFn findImpl = NULL;
+static const char *findName = "scalar";
+
+static int engineSupported(enum substringEngine engine) {
+    switch (engine) {
+        case SUBSTRING_SCALAR: return 1;
+#ifdef SUBSTRING_X86
+        case SUBSTRING_SSE2: return __builtin_cpu_supports("sse2");
+        case SUBSTRING_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return 0;
+    }
+}
+
+// picks the engine used by substringFind; AUTO takes the widest one the CPU
+// supports. Returns -1 if the requested one isn't available.
+int substringUseEngine(enum substringEngine engine) {
+    if (engine == SUBSTRING_AUTO) {
+        if (engineSupported(SUBSTRING_AVX2)) {
+            engine = SUBSTRING_AVX2;
+        }else if (engineSupported(SUBSTRING_SSE2)) {
+            engine = SUBSTRING_SSE2;
+        }else {
+            engine = SUBSTRING_SCALAR;
+        }
+    }
+    if (!engineSupported(engine)) return -1;
+
+    switch (engine) {
+#ifdef SUBSTRING_X86
+        case SUBSTRING_SSE2: findImpl = findSse2; findName = "sse2"; break;
+        case SUBSTRING_AVX2: findImpl = findAvx2; findName = "avx2"; break;
+#endif
+        default: findImpl = findScalar; findName = "scalar"; break;
+    }
+    return 0;
+}
+
+const char *substringEngineName(void) {
+    if (findImpl == NULL) substringUseEngine(SUBSTRING_AUTO);
+    return findName;
+}
+
+const char *substringFind(const char *hay, size_t len, const char *needle, size_t nlen) {
+    if (nlen == 0) return hay;
+    if (nlen > len) return NULL;
+    // memchr is already vectorized and the block compare needs two bytes
+    if (nlen == 1) return memchr(hay, needle[0], len);
+
+    if (findImpl == NULL) substringUseEngine(SUBSTRING_AUTO);
+    return findImpl(hay, len, needle, nlen);
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/undolog.h"
+
+/*** storage ***/
+
+static size_t opSize(int len) {
+    size_t size = sizeof(struct undoOp) + len;
+    return (size + sizeof(int) - 1) & ~(sizeof(int) - 1);
+}
+
+static struct undoOp *opAt(const struct undoLog *log, size_t off) {
+    return (struct undoOp *)&log->data[off];
+}
+
+static size_t opOffset(const struct undoLog *log, const struct undoOp *op) {
+    return (const char *)op - log->data;
+}
+
+void undoLogFree(struct undoLog *log) {
+    size_t budget = log->budget;
+    free(log->data);
+    memset(log, 0, sizeof(*log));
+    log->budget = budget;
+}
+
+void undoLogSetBudget(struct undoLog *log, size_t budget) {
+    log->budget = budget;
+}
+
+size_t undoLogBytes(const struct undoLog *log) {
+    return log->top - log->head;
+}
+
+// makes room for `more` bytes past top, sliding the log to the front of the
+// buffer instead of growing it when most of the buffer is dropped steps
+static void undoLogReserve(struct undoLog *log, size_t more) {
+    if (log->top + more <= log->cap) return;
+
+    size_t used = log->top - log->head;
+    if (log->head > used && used + more <= log->cap) {
+        memmove(log->data, &log->data[log->head], used);
+        log->end -= log->head;
+        log->top -= log->head;
+        log->last -= log->head;
+        log->group -= log->head;
+        log->head = 0;
+        return;
+    }
+
+    size_t cap = log->cap ? log->cap : 4096;
+    while (cap < log->top + more) cap *= 2;
+    log->data = realloc(log->data, cap);
+    if (log->data == NULL) abort();
+    log->cap = cap;
+}
+
+static size_t undoLogAppend(struct undoLog *log, int type, int row, int at, int len) {
+    undoLogReserve(log, opSize(len));
+    size_t off = log->top;
+    struct undoOp *op = opAt(log, off);
+    op->type = type;
+    op->back = (off == log->head) ? 0 : (int)(off - log->last);
+    op->row = row;
+    op->at = at;
+    op->len = len;
+    log->top += opSize(len);
+    log->end = log->top;
+    log->last = off;
+    return off;
+}
+
+// drops whole steps from the front until the log fits, never the open one
+static void undoLogTrim(struct undoLog *log) {
+    while (log->top - log->head > log->budget && log->head < log->group) {
+        size_t off = log->head + opSize(opAt(log, log->head)->len);
+        while (off < log->group && opAt(log, off)->type != UNDO_GROUP) {
+            off += opSize(opAt(log, off)->len);
+        }
+        log->head = off;
+    }
+}
+
+/*** recording ***/
+
+static int undoLogMerge(struct undoLog *log, int type, int row, int at, const char *text, int len) {
+    if (!log->open || log->last == log->group) return 0;
+    struct undoOp *op = opAt(log, log->last);
+    if (op->type != type || op->row != row) return 0;
+
+    int append;
+    if (type == UNDO_INSERT_CHARS && at == op->at + op->len) {
+        append = 1;
+    }else if (type == UNDO_DELETE_CHARS && at == op->at) {
+        append = 1;
+    }else if (type == UNDO_DELETE_CHARS && at + len == op->at) {
+        append = 0;
+    }else {
+        return 0;
+    }
+
+    size_t grow = opSize(op->len + len) - opSize(op->len);
+    undoLogReserve(log, grow);
+    op = opAt(log, log->last);
+    char *payload = (char *)(op + 1);
+    if (append) {
+        memcpy(&payload[op->len], text, len);
+    }else {
+        memmove(&payload[len], payload, op->len);
+        memcpy(payload, text, len);
+        op->at = at;
+    }
+    op->len += len;
+    log->top += grow;
+    log->end = log->top;
+    return 1;
+}
+
+static void undoLogSetCursorAfter(struct undoLog *log, int cursorRow, int cursorAt) {
+    int cursor[2] = { cursorRow, cursorAt };
+    memcpy((char *)(opAt(log, log->group) + 1), cursor, sizeof(cursor));
+}
+
+void undoLogAdd(struct undoLog *log, int type, int row, int at, const char *text, int len,
+                int cursorRow, int cursorAt) {
+    if (!log->open) {
+        // a new edit after undoing loses what could have been redone
+        log->top = log->end;
+        log->group = undoLogAppend(log, UNDO_GROUP, cursorRow, cursorAt, 2 * sizeof(int));
+        undoLogSetCursorAfter(log, cursorRow, cursorAt);
+        log->open = 1;
+    }
+    if (!undoLogMerge(log, type, row, at, text, len)) {
+        size_t off = undoLogAppend(log, type, row, at, len);
+        memcpy((char *)(opAt(log, off) + 1), text, len);
+    }
+    undoLogTrim(log);
+}
+
+void undoLogSeal(struct undoLog *log, int cursorRow, int cursorAt) {
+    if (!log->open) return;
+    undoLogSetCursorAfter(log, cursorRow, cursorAt);
+    log->open = 0;
+}
+
+void undoLogCursorAfter(const struct undoOp *group, int *row, int *at) {
+    int cursor[2];
+    memcpy(cursor, undoOpText(group), sizeof(cursor));
+    *row = cursor[0];
+    *at = cursor[1];
+}
+
+/*** walking ***/
+
+struct undoOp *undoLogNext(const struct undoLog *log, const struct undoOp *op) {
+    size_t off = opOffset(log, op) + opSize(op->len);
+    if (off >= log->top || opAt(log, off)->type == UNDO_GROUP) return NULL;
+    return opAt(log, off);
+}
+
+struct undoOp *undoLogPrev(const struct undoLog *log, const struct undoOp *op) {
+    size_t off = opOffset(log, op);
+    if (op->type == UNDO_GROUP || off == log->head) return NULL;
+    struct undoOp *prev = opAt(log, off - op->back);
+    return (prev->type == UNDO_GROUP) ? NULL : prev;
+}
+
+struct undoOp *undoLogUndo(struct undoLog *log) {
+    if (log->open) return NULL;
+    if (log->end == log->head) return NULL;
+
+    size_t off = log->last;
+    while (opAt(log, off)->type != UNDO_GROUP) {
+        off -= opAt(log, off)->back;
+    }
+    log->end = off;
+    log->last = off - opAt(log, off)->back;
+    return opAt(log, off);
+}
+
+struct undoOp *undoLogRedo(struct undoLog *log) {
+    if (log->open) return NULL;
+    if (log->end == log->top) return NULL;
+
+    struct undoOp *group = opAt(log, log->end);
+    const struct undoOp *op = group;
+    const struct undoOp *next;
+    while ((next = undoLogNext(log, op)) != NULL) {
+        op = next;
+    }
+    log->last = opOffset(log, op);
+    log->end = log->last + opSize(op->len);
+    return group;
+}
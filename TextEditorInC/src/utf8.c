@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/utf8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86 1
+#endif
+
+/*** decoding ***/
+
+int utf8CharLen(const unsigned char *s) {
+    if (s[0] < 0xc0) return 1;
+    if (s[0] < 0xe0) return 2;
+    if (s[0] < 0xf0) return 3;
+    if (s[0] < 0xf8) return 4;
+    return 1;
+}
+
+int utf8IsStartByte(unsigned char c) {
+    return (c & 0xc0) != 0x80;
+}
+
+int utf8Decode(const char *s, int len, int *cp) {
+    static const int least[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    const unsigned char *u = (const unsigned char *)s;
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    }
+
+    *cp = -1;
+    int n = utf8CharLen(u);
+    if (n == 1 || n > len) return 1;
+    int c = u[0] & (0x7f >> n);
+    for (int i = 1; i < n; i++) {
+        if ((u[i] & 0xc0) != 0x80) return 1;
+        c = (c << 6) | (u[i] & 0x3f);
+    }
+    // overlong forms, surrogates and anything past the last code point
+    if (c < least[n] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) return 1;
+    *cp = c;
+    return n;
+}
+
+/*** width ***/
+
+struct utf8Range {
+    int first;
+    int last;
+};
+
+static const struct utf8Range zeroWidth[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf},
+    {0x05c1, 0x05c2}, {0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a},
+    {0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x06df, 0x06e4},
+    {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0900, 0x0902}, {0x093a, 0x093a},
+    {0x093c, 0x093c}, {0x0941, 0x0948}, {0x094d, 0x094d}, {0x0951, 0x0957},
+    {0x0962, 0x0963}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e},
+    {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x200b, 0x200f}, {0x202a, 0x202e},
+    {0x2060, 0x2064}, {0x20d0, 0x20ff}, {0x302a, 0x302d}, {0x3099, 0x309a},
+    {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0xfeff, 0xfeff}, {0xe0100, 0xe01ef},
+};
+
+static const struct utf8Range doubleWidth[] = {
+    {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+    {0x23f0, 0x23f0}, {0x23f3, 0x23f3}, {0x25fd, 0x25fe}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267f, 0x267f}, {0x2693, 0x2693}, {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26ce, 0x26ce},
+    {0x26d4, 0x26d4}, {0x26ea, 0x26ea}, {0x26f2, 0x26f3}, {0x26f5, 0x26f5},
+    {0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b},
+    {0x2728, 0x2728}, {0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27b0, 0x27b0}, {0x27bf, 0x27bf},
+    {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55}, {0x2e80, 0x303e},
+    {0x3041, 0x3247}, {0x3250, 0x4dbf}, {0x4e00, 0xa4cf}, {0xa960, 0xa97f},
+    {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6f},
+    {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x16fe4}, {0x17000, 0x18cff},
+    {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e},
+    {0x1f191, 0x1f19a}, {0x1f200, 0x1f251}, {0x1f300, 0x1f64f}, {0x1f680, 0x1f6ff},
+    {0x1f900, 0x1f9ff}, {0x1fa70, 0x1faff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+static int utf8InRanges(int cp, const struct utf8Range *ranges, int count) {
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < ranges[mid].first) {
+            hi = mid - 1;
+        }else if (cp > ranges[mid].last) {
+            lo = mid + 1;
+        }else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int utf8Width(int cp) {
+    if (cp < 0x300) return 1;
+    if (utf8InRanges(cp, zeroWidth, sizeof(zeroWidth) / sizeof(zeroWidth[0]))) return 0;
+    if (cp >= 0x1100 && utf8InRanges(cp, doubleWidth, sizeof(doubleWidth) / sizeof(doubleWidth[0]))) return 2;
+    return 1;
+}
+
+/*** ascii runs ***/
+
+static size_t asciiPrefixScalar(const char *s, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, &s[i], 8);
+        if (word & 0x8080808080808080ull) break;
+    }
+    while (i < len && (unsigned char)s[i] < 0x80) i++;
+    return i;
+}
+
+#ifdef UTF8_X86
+
+__attribute__((target("sse2")))
+static size_t asciiPrefixSse2(const char *s, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&s[i]));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + asciiPrefixScalar(&s[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t asciiPrefixAvx2(const char *s, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint32_t mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)&s[i]));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + asciiPrefixScalar(&s[i], len - i);
+}
+
+#endif
+
+typedef size_t (*asciiPrefixFn)(const char *, size_t);
+
+static asciiPrefixFn asciiPrefixImpl = NULL;
+
+// the top bit of every byte is what movemask collects, so one instruction
+// tells whether a block is all ASCII
+size_t utf8AsciiPrefix(const char *s, size_t len) {
+    if (asciiPrefixImpl == NULL) {
+        asciiPrefixImpl = asciiPrefixScalar;
+#ifdef UTF8_X86
+        if (__builtin_cpu_supports("avx2")) {
+            asciiPrefixImpl = asciiPrefixAvx2;
+        }else if (__builtin_cpu_supports("sse2")) {
+            asciiPrefixImpl = asciiPrefixSse2;
+        }
+#endif
+    }
+    return asciiPrefixImpl(s, len);
+}
+
+/*** cursor steps ***/
+
+static int utf8ZeroWidthAt(const erow *row, int at, int *len) {
+    int cp;
+    *len = utf8Decode(&row->chars[at], row->size - at, &cp);
+    return cp >= 0 && utf8Width(cp) == 0;
+}
+
+int utf8NextCharIndex(const erow *row, int cx) {
+    if (cx >= row->size) return row->size;
+    int len;
+    utf8ZeroWidthAt(row, cx, &len);
+    cx += len;
+    // combining marks are never ASCII, so neither is what they follow
+    while (cx < row->size && (unsigned char)row->chars[cx] >= 0x80 && utf8ZeroWidthAt(row, cx, &len)) {
+        cx += len;
+    }
+    return cx;
+}
+
+// start of the character that ends at cx, or cx - 1 if it doesn't decode
+static int utf8CharStartBefore(const erow *row, int cx) {
+    int at = cx - 1;
+    while (at > 0 && cx - at < 4 && !utf8IsStartByte(row->chars[at])) at--;
+
+    int cp;
+    if (at + utf8Decode(&row->chars[at], row->size - at, &cp) != cx) return cx - 1;
+    return at;
+}
+
+int utf8PrevCharIndex(const erow *row, int cx) {
+    if (cx > row->size) cx = row->size;
+    int len;
+    do {
+        if (cx <= 0) return 0;
+        cx = utf8CharStartBefore(row, cx);
+    } while ((unsigned char)row->chars[cx] >= 0x80 && utf8ZeroWidthAt(row, cx, &len));
+    return cx;
+}
+
+int utf8CharStart(const erow *row, int cx) {
+    if (cx <= 0) return 0;
+    if (cx >= row->size) return row->size;
+    if ((unsigned char)row->chars[cx] < 0x80) return cx;
+
+    // a start byte always begins a character; a continuation byte only
+    // does if it isn't part of the sequence before it
+    int at = cx;
+    while (at > 0 && cx - at < 3 && !utf8IsStartByte(row->chars[at])) at--;
+    int cp;
+    if (at < cx && at + utf8Decode(&row->chars[at], row->size - at, &cp) > cx) cx = at;
+
+    int len;
+    if (utf8ZeroWidthAt(row, cx, &len)) cx = utf8PrevCharIndex(row, cx);
+    return cx;
+}
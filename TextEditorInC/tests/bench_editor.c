@@ -0,0 +1,474 @@
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../include/editor.h"
+#include "../include/lineindex.h"
+
+#define BENCH_RUNS 3
+// a run slower than its baseline by more than this many percent regresses
+#define BENCH_TOLERANCE 10.0
+// frames drawn per run of the drawRows benchmark
+#define BENCH_FRAMES 2000
+
+/*** allocation counting ***/
+
+// The editor's calls to malloc land here, in front of glibc's allocator,
+// so each benchmark can report how many allocations an operation costs.
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void  __libc_free(void *ptr);
+
+static long allocCount = 0;
+static long allocBytes = 0;
+
+static void countAlloc(size_t bytes) {
+    __atomic_fetch_add(&allocCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&allocBytes, (long)bytes, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    countAlloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    countAlloc(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    countAlloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+/*** helpers ***/
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// writes roughly `bytes` of log-like lines of varying length to a temp file
+static void writeLog(char *path, size_t bytes) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(1);
+    }
+    FILE *fp = fdopen(fd, "w");
+
+    unsigned int seed = 1;
+    size_t written = 0;
+    int line = 0;
+    while (written < bytes) {
+        seed = seed * 1103515245 + 12345;
+        int pad = (seed >> 16) % 120;
+        written += fprintf(fp, "2025-11-14 12:00:%02d INFO worker-%d request %d %.*s\n",
+                           line % 60, line % 16, line, pad,
+                           "................................................................"
+                           "........................................................");
+        line++;
+    }
+    fclose(fp);
+}
+
+/*** line index ***/
+
+static void benchGetline(const char *path, size_t size) {
+    double best = 1e9;
+    long lines = 0;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = now();
+        FILE *fp = fopen(path, "r");
+        char *line = NULL;
+        size_t lineCap = 0;
+        lines = 0;
+        while (getline(&line, &lineCap, fp) != -1) {
+            lines++;
+        }
+        free(line);
+        fclose(fp);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("%-10s %10ld lines %8.3f ms %7.2f GB/s\n", "getline", lines, best * 1e3, size / best / 1e9);
+}
+
+static void benchScanner(enum lineScanner scanner, const char *data, size_t size) {
+    if (lineIndexUseScanner(scanner) == -1) {
+        printf("%-10s unsupported on this CPU\n", "");
+        return;
+    }
+
+    double best = 1e9;
+    struct lineIndex index;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        lineIndexInit(&index);
+        double start = now();
+        lineIndexAdd(&index, 0);
+        lineIndexScan(&index, data, 0, size, size);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+        if (run + 1 < BENCH_RUNS) lineIndexFree(&index);
+    }
+    printf("%-10s %10d lines %8.3f ms %7.2f GB/s  (index %zu KB)\n", lineIndexScannerName(),
+           index.nrStarts, best * 1e3, size / best / 1e9, lineIndexBytes(&index) / 1024);
+    lineIndexFree(&index);
+}
+
+static void benchLineIndex(size_t bytes) {
+    char path[] = "/tmp/bench_editorXXXXXX";
+    writeLog(path, bytes);
+
+    int fd = open(path, O_RDONLY);
+    size_t size = lseek(fd, 0, SEEK_END);
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    // fault the pages in so every scanner sees a warm page cache
+    volatile char sink = 0;
+    for (size_t i = 0; i < size; i += 4096) sink ^= data[i];
+    (void)sink;
+
+    printf("line index: %.1f MB\n", size / 1e6);
+    benchGetline(path, size);
+    benchScanner(LINE_SCAN_SCALAR, data, size);
+    benchScanner(LINE_SCAN_SSE2, data, size);
+    benchScanner(LINE_SCAN_AVX2, data, size);
+    lineIndexUseScanner(LINE_SCAN_AUTO);
+
+    munmap(data, size);
+    unlink(path);
+}
+
+/*** editor operations ***/
+
+/* Every benchmark reports the best of BENCH_RUNS runs, per operation: per
+ * line for the ones that go over the whole buffer, per frame for
+ * drawRows. Bytes are what was asked of malloc, not what stayed live. */
+
+struct benchResult {
+    char name[32];
+    int lines;
+    double ns;
+    double bytes;
+    double allocs;
+};
+
+struct measure {
+    double start;
+    long allocs;
+    long bytes;
+};
+
+static void measureBegin(struct measure *m) {
+    m->allocs = allocCount;
+    m->bytes = allocBytes;
+    m->start = now();
+}
+
+// keeps the run in *r if it is the fastest so far
+static void measureEnd(struct measure *m, long ops, struct benchResult *r) {
+    double ns = (now() - m->start) * 1e9 / ops;
+    if (r->ns == 0 || ns < r->ns) {
+        r->ns = ns;
+        r->bytes = (double)(allocBytes - m->bytes) / ops;
+        r->allocs = (double)(allocCount - m->allocs) / ops;
+    }
+}
+
+static void resetEditor(void) {
+    while (E.nrBuffers > 0) editorBufferClose(0);
+    free(E.buffers);
+    memset(&E, 0, sizeof(E));
+    editorBufferNew();
+    E.screenrows = 50;
+    E.screencols = 200;
+}
+
+// line `i` of a generated C file: declarations, comments, strings and
+// block comments in a fixed rotation
+static int genLine(int i, char *buf, size_t size) {
+    switch (i % 8) {
+        case 0: return snprintf(buf, size, "static int value%d = %d; // counter %d", i, i * 7, i);
+        case 1: return snprintf(buf, size, "\tif (value%d > %d.5) {", i - 1, i);
+        case 2: return snprintf(buf, size, "\t\treturn process(\"line %d\", '%c', %d);", i, 'a' + i % 26, i);
+        case 3: return snprintf(buf, size, "\t}");
+        case 4: return snprintf(buf, size, "/* block comment %d", i);
+        case 5: return snprintf(buf, size, "   still inside the comment, while for struct */");
+        case 6: return snprintf(buf, size, "unsigned long total%d(char *s, double d);", i);
+        default: buf[0] = '\0'; return 0;
+    }
+}
+
+static void fillEditor(int lines) {
+    resetEditor();
+    E.buf->filename = strdup("bench.c");
+    editorSelectSyntaxHighlight();
+    char line[128];
+    for (int i = 0; i < lines; i++) {
+        editorInsertRow(i, line, genLine(i, line, sizeof(line)));
+    }
+    editorUndoClear();
+}
+
+static void writeSource(char *path, int lines) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(1);
+    }
+    FILE *fp = fdopen(fd, "w");
+    char line[128];
+    for (int i = 0; i < lines; i++) {
+        genLine(i, line, sizeof(line));
+        fprintf(fp, "%s\n", line);
+    }
+    fclose(fp);
+}
+
+static void benchInsertRow(int lines, struct benchResult *r) {
+    char line[128];
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        resetEditor();
+        struct measure m;
+        measureBegin(&m);
+        for (int i = 0; i < lines; i++) {
+            editorInsertRow(i, line, genLine(i, line, sizeof(line)));
+        }
+        measureEnd(&m, lines, r);
+    }
+}
+
+static void benchUpdateSyntax(int lines, struct benchResult *r) {
+    fillEditor(lines);
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        struct measure m;
+        measureBegin(&m);
+        for (erow *row = editorRowAt(0); row; row = editorRowNext(row)) {
+            editorUpdateSyntax(row);
+        }
+        measureEnd(&m, lines, r);
+    }
+}
+
+// every row again, split across one thread per core
+static void benchSyntaxAll(int lines, struct benchResult *r) {
+    fillEditor(lines);
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        editorSelectSyntaxHighlight();
+        struct measure m;
+        measureBegin(&m);
+        editorSyntaxAll(0);
+        measureEnd(&m, lines, r);
+    }
+}
+
+static void benchRowToString(int lines, struct benchResult *r) {
+    fillEditor(lines);
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        struct measure m;
+        measureBegin(&m);
+        int len;
+        char *text = editorRowToString(&len);
+        measureEnd(&m, lines, r);
+        free(text);
+    }
+}
+
+static void benchDrawRows(int lines, struct benchResult *r) {
+    fillEditor(lines);
+    // the first frame sizes the screen
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    editorRefreshScreen();
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devNull);
+
+    // pages through the file, so most frames show rows not drawn before
+    unsigned int seed = 3;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        struct measure m;
+        measureBegin(&m);
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            seed = seed * 1103515245 + 12345;
+            E.buf->rowOff = (seed >> 8) % lines;
+            editorDrawRows();
+        }
+        measureEnd(&m, BENCH_FRAMES, r);
+    }
+}
+
+// open runs until the whole file is indexed, which a mapped file would
+// otherwise finish in the background
+static void benchOpen(int lines, struct benchResult *r) {
+    char path[] = "/tmp/bench_editorXXXXXX";
+    writeSource(path, lines);
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        resetEditor();
+        struct measure m;
+        measureBegin(&m);
+        editorOpen(path);
+        editorMapFinishIndex();
+        measureEnd(&m, lines, r);
+    }
+    resetEditor();
+    unlink(path);
+}
+
+struct bench {
+    const char *name;
+    void (*run)(int lines, struct benchResult *r);
+};
+
+static const struct bench benches[] = {
+    { "insertRow", benchInsertRow },
+    { "updateSyntax", benchUpdateSyntax },
+    { "syntaxAll", benchSyntaxAll },
+    { "rowToString", benchRowToString },
+    { "drawRows", benchDrawRows },
+    { "open", benchOpen },
+};
+
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/*** baseline ***/
+
+// results of an earlier run, one "name lines ns bytes allocs" per line
+static struct benchResult *loadBaseline(const char *path, int *count) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    int cap = 16;
+    struct benchResult *base = malloc(sizeof(*base) * cap);
+    *count = 0;
+    struct benchResult r;
+    while (fscanf(fp, "%31s %d %lf %lf %lf", r.name, &r.lines, &r.ns, &r.bytes, &r.allocs) == 5) {
+        if (*count == cap) {
+            cap *= 2;
+            base = realloc(base, sizeof(*base) * cap);
+        }
+        base[(*count)++] = r;
+    }
+    fclose(fp);
+    return base;
+}
+
+static const struct benchResult *findBaseline(const struct benchResult *base, int count,
+                                              const struct benchResult *r) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(base[i].name, r->name) == 0 && base[i].lines == r->lines) return &base[i];
+    }
+    return NULL;
+}
+
+// prints a result and how it compares; returns 1 if it regressed
+static int report(const struct benchResult *r, const struct benchResult *base, double tolerance) {
+    printf("%-14s %9d %12.1f %11.1f %10.2f", r->name, r->lines, r->ns, r->bytes, r->allocs);
+    if (base == NULL) {
+        printf("\n");
+        return 0;
+    }
+    double change = (r->ns - base->ns) / base->ns * 100;
+    // allocation counts don't jitter, so any real increase is a regression
+    int slower = change > tolerance;
+    int allocates = r->allocs > base->allocs * 1.01 + 0.01;
+    printf(" %+8.1f%%%s%s\n", change, slower ? "  SLOWER" : "", allocates ? "  MORE ALLOCS" : "");
+    return slower || allocates;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [--lines N,N,...] [--only NAME] [--save FILE] [--compare FILE]\n"
+            "          [--tolerance PERCENT] [--line-index MB]\n", name);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int lineCounts[16] = { 1000, 100000, 1000000 };
+    int nrLineCounts = 3;
+    const char *only = NULL;
+    const char *savePath = NULL;
+    const char *comparePath = NULL;
+    double tolerance = BENCH_TOLERANCE;
+    size_t indexMegabytes = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) usage(argv[0]);
+        if (strcmp(argv[i], "--lines") == 0) {
+            nrLineCounts = 0;
+            for (char *p = argv[++i]; *p && nrLineCounts < 16; p++) {
+                lineCounts[nrLineCounts++] = strtol(p, &p, 10);
+                if (*p != ',') break;
+            }
+        }else if (strcmp(argv[i], "--only") == 0) {
+            only = argv[++i];
+        }else if (strcmp(argv[i], "--save") == 0) {
+            savePath = argv[++i];
+        }else if (strcmp(argv[i], "--compare") == 0) {
+            comparePath = argv[++i];
+        }else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[++i]);
+        }else if (strcmp(argv[i], "--line-index") == 0) {
+            indexMegabytes = atoi(argv[++i]);
+        }else {
+            usage(argv[0]);
+        }
+    }
+
+    if (indexMegabytes) {
+        benchLineIndex(indexMegabytes << 20);
+        return 0;
+    }
+
+    int nrBase = 0;
+    struct benchResult *base = comparePath ? loadBaseline(comparePath, &nrBase) : NULL;
+    FILE *save = NULL;
+    if (savePath && (save = fopen(savePath, "w")) == NULL) {
+        perror(savePath);
+        return 1;
+    }
+
+    printf("%-14s %9s %12s %11s %10s%s\n", "benchmark", "lines", "ns/op", "bytes/op", "allocs/op",
+           base ? "  vs baseline" : "");
+    int regressions = 0;
+    for (size_t b = 0; b < NR_BENCHES; b++) {
+        if (only && strcmp(only, benches[b].name) != 0) continue;
+        for (int i = 0; i < nrLineCounts; i++) {
+            struct benchResult r = {0};
+            snprintf(r.name, sizeof(r.name), "%s", benches[b].name);
+            r.lines = lineCounts[i];
+            benches[b].run(r.lines, &r);
+            regressions += report(&r, base ? findBaseline(base, nrBase, &r) : NULL, tolerance);
+            fflush(stdout);
+            if (save) fprintf(save, "%s %d %.1f %.1f %.3f\n", r.name, r.lines, r.ns, r.bytes, r.allocs);
+        }
+    }
+    resetEditor();
+
+    if (save) fclose(save);
+    free(base);
+    if (regressions) {
+        printf("%d regression%s against %s\n", regressions, regressions == 1 ? "" : "s", comparePath);
+        return 1;
+    }
+    return 0;
+}
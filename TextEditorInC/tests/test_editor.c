@@ -1,30 +1,38 @@
 //
 // Created by vikto on 2025-11-14.
 //
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include "../include/automaton.h"
 #include "../include/editor.h"
+#include "../include/keywords.h"
+#include "../include/lineindex.h"
+#include "../include/perf.h"
+#include "../include/rowalloc.h"
+#include "../include/rowtree.h"
+#include "../include/substring.h"
+#include "../include/undolog.h"
+#include "../include/utf8.h"
 
 /*** Resets the editor for each test ***/
 static void resetEditor(void) {
 
-    if (E.row) {
-        for (int i = 0; i < E.nrRows; i++) {
-            editorFreeRow(&E.row[i]);
-        }
-        free(E.row);
-    }
+    while (E.nrBuffers > 0) editorBufferClose(0);
+    free(E.buffers);
 
     memset(&E, 0, sizeof(E));
 
-    E.row = NULL;
-    E.nrRows = 0;
-    E.dirty = 0;
-    E.filename = NULL;
-    E.syntax = NULL;
+    editorBufferNew();
     E.screenrows = 24;
     E.screencols = 80;
 }
@@ -35,22 +43,1507 @@ static void test_inserAndDeleteRows(void) {
     editorInsertRow(0, "Hello", 5);
     editorInsertRow(1, "World", 5);
 
-    assert(E.nrRows == 2);
-    assert(strcmp(E.row[0].chars, "Hello") == 0);
-    assert(strcmp(E.row[1].chars, "World") == 0);
-    assert(E.row[0].index == 0);
-    assert(E.row[1].index == 1);
+    assert(E.buf->nrRows == 2);
+    assert(strcmp(editorRowAt(0)->chars, "Hello") == 0);
+    assert(strcmp(editorRowAt(1)->chars, "World") == 0);
+    assert(editorRowIndex(editorRowAt(0)) == 0);
+    assert(editorRowIndex(editorRowAt(1)) == 1);
 
     editorDelRow(0);
 
-    assert(E.nrRows == 1);
-    assert(strcmp(E.row[0].chars, "World") == 0);
-    assert(E.row[0].index == 0);
+    assert(E.buf->nrRows == 1);
+    assert(strcmp(editorRowAt(0)->chars, "World") == 0);
+    assert(editorRowIndex(editorRowAt(0)) == 0);
+}
+
+static void test_rowTreeMatchesArray(void) {
+    resetEditor();
+
+    enum { OPS = 4000 };
+    static int expected[OPS];
+    int count = 0;
+    char buf[16];
+    unsigned int seed = 12345;
+
+    for (int i = 0; i < OPS; i++) {
+        seed = seed * 1103515245 + 12345;
+        int at = count ? (int)((seed >> 8) % (count + 1)) : 0;
+        if (count > 0 && (seed & 3) == 0) {
+            if (at == count) at--;
+            editorDelRow(at);
+            memmove(&expected[at], &expected[at + 1], sizeof(int) * (count - at - 1));
+            count--;
+        }else {
+            int len = snprintf(buf, sizeof(buf), "%d", i);
+            editorInsertRow(at, buf, len);
+            memmove(&expected[at + 1], &expected[at], sizeof(int) * (count - at));
+            expected[at] = i;
+            count++;
+        }
+    }
+
+    assert(E.buf->nrRows == count);
+    int j = 0;
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row), j++) {
+        snprintf(buf, sizeof(buf), "%d", expected[j]);
+        assert(strcmp(row->chars, buf) == 0);
+        assert(editorRowIndex(row) == j);
+        assert(editorRowAt(j) == row);
+    }
+    assert(j == count);
+}
+
+static void test_openMappedIsLazy(void) {
+    resetEditor();
+
+    char path[] = "/tmp/test_editorXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < 100000; i++) {
+        fprintf(fp, "line %d\r\n", i);
+    }
+    fprintf(fp, "last");
+    fclose(fp);
+
+    assert(editorOpenMapped(path) == 0);
+    assert(E.buf->nrRows > E.screenrows);
+    assert(E.buf->nrRows < 100001);
+    assert(editorMapIndexing());
+
+    editorMapFinishIndex();
+    assert(E.buf->nrRows == 100001);
+    assert(E.buf->dirty == 0);
+
+    erow *row = editorRowAt(50000);
+    assert(row->charsMapped);
+    assert(row->size == 10 && memcmp(row->chars, "line 50000", 10) == 0);
+    assert(row->rsize == 10 && strcmp(row->render, "line 50000") == 0);
+    row = editorRowAt(100000);
+    assert(row->size == 4 && memcmp(row->chars, "last", 4) == 0);
+
+    editorRowInsertChar(editorRowAt(50000), 0, '>');
+    row = editorRowAt(50000);
+    assert(!row->charsMapped);
+    assert(strcmp(row->chars, ">line 50000") == 0);
+
+    editorInsertRow(7, "new", 3);
+    editorDelRow(99999);
+    assert(E.buf->nrRows == 100001);
+    assert(strcmp(editorRowAt(7)->chars, "new") == 0);
+    assert(memcmp(editorRowAt(8)->chars, "line 7", 6) == 0);
+    assert(editorRowIndex(editorRowAt(50001)) == 50001);
+
+    int len;
+    char *buf = editorRowToString(&len);
+    assert(memcmp(buf, "line 0\nline 1\n", 14) == 0);
+    assert(memcmp(&buf[len - 16], "line 99999\nlast\n", 16) == 0);
+    free(buf);
+
+    unlink(path);
+}
+
+static void test_lineScannersAgree(void) {
+    enum { SIZE = 10000 };
+    static char data[SIZE];
+    unsigned int seed = 7;
+    for (int i = 0; i < SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 16) % 40;
+        data[i] = (r == 0) ? '\n' : (r == 1 && i > SIZE / 2) ? '\r' : 'a' + r % 26;
+    }
+    data[SIZE - 1] = '\n';
+
+    struct lineIndex expected;
+    lineIndexInit(&expected);
+    lineIndexUseScanner(LINE_SCAN_SCALAR);
+    lineIndexAdd(&expected, 0);
+    lineIndexScan(&expected, data, 0, SIZE, SIZE);
+    assert(expected.hasCR);
+
+    enum lineScanner scanners[] = { LINE_SCAN_SSE2, LINE_SCAN_AVX2 };
+    for (int s = 0; s < 2; s++) {
+        if (lineIndexUseScanner(scanners[s]) == -1) continue;
+
+        // scanned in uneven slices, like editorMapIndexSlice does
+        struct lineIndex index;
+        lineIndexInit(&index);
+        lineIndexAdd(&index, 0);
+        for (size_t from = 0; from < SIZE; from += 777) {
+            size_t to = from + 777 < SIZE ? from + 777 : SIZE;
+            lineIndexScan(&index, data, from, to, SIZE);
+        }
+        assert(index.nrStarts == expected.nrStarts);
+        assert(index.hasCR);
+        for (int i = 0; i < index.nrStarts; i++) {
+            assert(lineIndexStart(&index, i) == lineIndexStart(&expected, i));
+        }
+        lineIndexFree(&index);
+    }
+    lineIndexUseScanner(LINE_SCAN_AUTO);
+
+    for (int i = 0; i < expected.nrStarts; i++) {
+        size_t start = lineIndexStart(&expected, i);
+        assert(lineIndexLineAt(&expected, start) == i);
+        assert(data[start - (i > 0)] == (i > 0 ? '\n' : data[0]));
+    }
+    lineIndexFree(&expected);
+}
+
+static void test_lazyHighlightPropagation(void) {
+    resetEditor();
+    E.buf->filename = strdup("lazy.c");
+    editorSelectSyntaxHighlight();
+
+    char *lines[] = { "int a;", "x /* y", "bbb", "ccc", "z */ int", "int d;" };
+    for (int i = 0; i < 6; i++) {
+        editorInsertRow(i, lines[i], strlen(lines[i]));
+    }
+    // nothing is highlighted until a row is needed
+    for (int i = 0; i < 6; i++) {
+        assert(editorRowAt(i)->hlDirty);
+    }
+
+    editorSyntaxEnsure(editorRowAt(3));
+    assert(editorRowHighlightAt(editorRowAt(3), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(2), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(0), 0) == HL_KEYWORD2);
+    assert(editorRowAt(4)->hlDirty);
+    assert(editorRowAt(5)->hlDirty);
+
+    assert(editorSyntaxBackground(100) == 0);
+    assert(editorRowHighlightAt(editorRowAt(4), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(4), 5) == HL_KEYWORD2);
+    assert(editorRowHighlightAt(editorRowAt(5), 0) == HL_KEYWORD2);
+
+    // closing the comment early changes rows 2 and 3 but stops at row 4,
+    // whose entry state didn't change
+    editorRowAppenString(editorRowAt(1), " */", 3);
+    editorSyntaxEnsure(editorRowAt(5));
+    assert(editorRowHighlightAt(editorRowAt(2), 0) == HL_NORMAL);
+    assert(editorRowHighlightAt(editorRowAt(3), 0) == HL_NORMAL);
+    assert(editorRowHighlightAt(editorRowAt(4), 0) == HL_NORMAL);
+    assert(editorRowHighlightAt(editorRowAt(5), 0) == HL_KEYWORD2);
+
+    // a long open comment is propagated without recursion
+    resetEditor();
+    E.buf->filename = strdup("lazy.c");
+    editorSelectSyntaxHighlight();
+    for (int i = 0; i < 200000; i++) {
+        editorInsertRow(i, "x = y;", 6);
+    }
+    editorSyntaxBackground(200000);
+    editorRowInsertChar(editorRowAt(0), 0, '*');
+    editorRowInsertChar(editorRowAt(0), 0, '/');
+    editorSyntaxEnsure(editorRowAt(10));
+    assert(editorRowHighlightAt(editorRowAt(10), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(100000), 0) == HL_NORMAL);
+    while (editorSyntaxBackground(2048)) {
+    }
+    assert(editorRowHighlightAt(editorRowAt(199999), 0) == HL_COMMENT);
+}
+
+static void test_parallelHighlight(void) {
+    resetEditor();
+    E.buf->filename = strdup("parallel.c");
+    editorSelectSyntaxHighlight();
+    // comments opening in one chunk and closing chunks later, and one that
+    // closes on the first row of a chunk
+    char line[64];
+    for (int i = 0; i < 20000; i++) {
+        int len;
+        if (i == 1240 || i == 7000) {
+            len = snprintf(line, sizeof(line), "int open%d; /* comment", i);
+        }else if (i == 1250 || i == 9999) {
+            len = snprintf(line, sizeof(line), "end */ int a%d = %d;", i, i);
+        }else {
+            len = snprintf(line, sizeof(line), "x%d = \"s\" + %d; // note", i, i % 97);
+        }
+        editorInsertRow(i, line, len);
+    }
+
+    editorSyntaxAll(4);
+    assert(rowTreeFirstMarked(&E.buf->rows) == NULL);
+    assert(editorRowHighlightAt(editorRowAt(1245), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(1250), 8) == HL_KEYWORD2);
+    assert(editorRowHighlightAt(editorRowAt(8000), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(12000), 0) == HL_NORMAL);
+
+    // the same as highlighting one row after the other
+    struct hlSpan *spans[20000];
+    int nrSpans[20000];
+    for (int i = 0; i < 20000; i++) {
+        erow *row = editorRowAt(i);
+        nrSpans[i] = row->nrHl;
+        spans[i] = malloc(sizeof(struct hlSpan) * (row->nrHl + 1));
+        memcpy(spans[i], row->hl, sizeof(struct hlSpan) * row->nrHl);
+    }
+    editorSelectSyntaxHighlight();
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row)) {
+        editorUpdateSyntax(row);
+    }
+    for (int i = 0; i < 20000; i++) {
+        erow *row = editorRowAt(i);
+        assert(row->nrHl == nrSpans[i]);
+        assert(memcmp(row->hl, spans[i], sizeof(struct hlSpan) * row->nrHl) == 0);
+        free(spans[i]);
+    }
+
+    // a file read in whole is highlighted as it is opened
+    char path[] = "/tmp/test_editorXXXXXX.c";
+    int fd = mkstemps(path, 2);
+    assert(fd != -1);
+    assert(write(fd, "/* a\nb */ int c;\n", 17) == 17);
+    close(fd);
+    resetEditor();
+    editorOpen(path);
+    assert(rowTreeFirstMarked(&E.buf->rows) == NULL);
+    assert(editorRowHighlightAt(editorRowAt(1), 0) == HL_COMMENT);
+    assert(editorRowHighlightAt(editorRowAt(1), 5) == HL_KEYWORD2);
+    unlink(path);
+}
+
+static void test_keywordTrie(void) {
+    char *keywords[] = { "if", "int|", "in", "integer", "for", NULL };
+    struct keywordTrie *trie = keywordTrieBuild(keywords, HL_KEYWORD1, HL_KEYWORD2);
+    unsigned char type = 0;
+
+    assert(keywordTrieMatch(trie, "int x", 5, &type) == 3 && type == HL_KEYWORD2);
+    assert(keywordTrieMatch(trie, "if(", 3, &type) == 2 && type == HL_KEYWORD1);
+    assert(keywordTrieMatch(trie, "in", 2, &type) == 2 && type == HL_KEYWORD1);
+    assert(keywordTrieMatch(trie, "integer;", 8, &type) == 7);
+    assert(keywordTrieMatch(trie, "intx", 4, &type) == 0);
+    assert(keywordTrieMatch(trie, "fo", 2, &type) == 0);
+    assert(keywordTrieMatch(trie, "xif", 3, &type) == 0);
+    keywordTrieFree(trie);
+
+    assert(isSeparatorByte(' ') && isSeparatorByte('\0') && isSeparatorByte(';'));
+    assert(!isSeparatorByte('a') && !isSeparatorByte('_') && !isSeparatorByte((char)0xc3));
+
+    resetEditor();
+    E.buf->filename = strdup("kw.c");
+    editorSelectSyntaxHighlight();
+    editorInsertRow(0, "unsigned intx; return 42;", 25);
+    erow *row = editorRowAt(0);
+    editorSyntaxEnsure(row);
+    unsigned char expected[] = "2222222200000001111110000";
+    for (int i = 0; i < row->rsize; i++) {
+        int hl = expected[i] - '0';
+        if (hl == 1) hl = HL_KEYWORD1;
+        else if (hl == 2) hl = HL_KEYWORD2;
+        else if (row->render[i] == '4' || row->render[i] == '2') hl = HL_NUMBER;
+        assert(editorRowHighlightAt(row, i) == hl);
+    }
+    // runs are kept whole: unsigned, return and 42
+    assert(row->nrHl == 3 && row->hl[0].len == 8 && row->hl[2].hl == HL_NUMBER);
+}
+
+static void test_substringEnginesAgree(void) {
+    enum { SIZE = 5000 };
+    static char hay[SIZE];
+    unsigned int seed = 11;
+    for (int i = 0; i < SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        hay[i] = "aab\n"[(seed >> 16) % 4];
+    }
+
+    enum substringEngine engines[] = { SUBSTRING_SCALAR, SUBSTRING_SSE2, SUBSTRING_AVX2 };
+    for (int e = 0; e < 3; e++) {
+        if (substringUseEngine(engines[e]) == -1) continue;
+        for (int trial = 0; trial < 300; trial++) {
+            seed = seed * 1103515245 + 12345;
+            size_t nlen = 1 + (seed >> 8) % 9;
+            size_t from = (seed >> 12) % SIZE;
+            size_t len = (seed >> 4) % (SIZE - from + 1);
+            char needle[16];
+            for (size_t j = 0; j < nlen; j++) {
+                seed = seed * 1103515245 + 12345;
+                needle[j] = "aab"[(seed >> 16) % 3];
+            }
+            assert(substringFind(&hay[from], len, needle, nlen) == memmem(&hay[from], len, needle, nlen));
+        }
+    }
+    substringUseEngine(SUBSTRING_AUTO);
+}
+
+static void test_findIncremental(void) {
+    resetEditor();
+    editorInsertRow(0, "alpha beta", 10);
+    editorInsertRow(1, "\tbetamax beta", 13);
+    editorInsertRow(2, "gamma", 5);
+
+    editorFindCallback("b", 'b');
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 6);
+    editorFindCallback("be", 'e');
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 6);
+    editorFindCallback("be", ARROW_DOWN);
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 1);
+    editorFindCallback("be", ARROW_DOWN);
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 9);
+    editorFindCallback("be", ARROW_DOWN);
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 6);
+    editorFindCallback("be", ARROW_UP);
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 9);
+
+    // extending the query keeps only the matches that still fit
+    editorFindCallback("betam", 'm');
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 1);
+    editorFindCallback("betam", ARROW_DOWN);
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 1);
+    editorFindCallback("gam", 'm');
+    assert(E.buf->cursorY == 2 && E.buf->cursorX == 0);
+    editorFindCallback("gam", '\r');
+}
+
+static void test_automaton(void) {
+    struct {
+        const char *pattern, *line;
+        int start, end;
+    } cases[] = {
+        { "ab*", "xabbbc", 1, 5 },
+        { "a|ab|abc", "xabcd", 1, 4 },
+        { "(a|b)+c", "zzababcz", 2, 7 },
+        { "\\d{2,3}", "a1234", 1, 4 },
+        { "[^a-c]+", "abcdef", 3, 6 },
+        { "^foo", "xfoo", -1, -1 },
+        { "o$", "foo", 2, 3 },
+        { "x*", "abc", 0, 0 },
+        { "\\w+\\s\\w+", "  int main", 2, 10 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const char *error = NULL;
+        struct automaton *a = automatonCompile(cases[i].pattern, &error);
+        assert(a != NULL && error == NULL);
+        size_t start, end;
+        int found = automatonMatchLine(a, cases[i].line, strlen(cases[i].line), 0, &start, &end);
+        assert(found == (cases[i].start != -1));
+        if (found) assert((int)start == cases[i].start && (int)end == cases[i].end);
+        automatonFree(a);
+    }
+
+    // ^ and $ hold at every line of a buffer, and matches don't cross lines
+    const char *text = "one\ntwo\n\nthree\n";
+    struct automaton *a = automatonCompile("^t.*e$", NULL);
+    assert(automatonFindLine(a, text, strlen(text), 0) == 9);
+    automatonFree(a);
+    a = automatonCompile("^$", NULL);
+    assert(automatonFindLine(a, text, strlen(text), 0) == 8);
+    automatonFree(a);
+    a = automatonCompile("e.t", NULL);
+    assert(automatonFindLine(a, text, strlen(text), 0) == -1);
+    automatonFree(a);
+
+    // every match in a long line in one linear sweep, and the line's
+    // text read afresh when a sweep starts over at 0
+    size_t longLen = 1 << 18;
+    char *longLine = malloc(longLen);
+    for (size_t i = 0; i < longLen; i++) longLine[i] = (i % 3 == 2) ? 'b' : 'a';
+    a = automatonCompile("ab|a", NULL);
+    size_t from = 0, start, end;
+    int found = 0;
+    while (from <= longLen && automatonMatchLine(a, longLine, longLen, from, &start, &end)) {
+        assert(start == from && end == start + ((start % 3 == 1) ? 2 : 1));
+        found++;
+        from = end;
+    }
+    assert(found == (int)(longLen / 3) * 2 + 1);
+    memset(longLine, 'b', longLen);
+    assert(!automatonMatchLine(a, longLine, longLen, 0, &start, &end));
+    longLine[longLen - 1] = 'a';
+    assert(automatonMatchLine(a, longLine, longLen, 0, &start, &end) && start == longLen - 1);
+    automatonFree(a);
+    free(longLine);
+
+    const char *error = NULL;
+    assert(automatonCompile("(ab", &error) == NULL && strcmp(error, "missing )") == 0);
+    assert(automatonCompile("*a", &error) == NULL && strcmp(error, "nothing to repeat") == 0);
+    assert(automatonCompile("[z-a]", &error) == NULL && strcmp(error, "bad range") == 0);
+}
+
+static void test_findRegex(void) {
+    resetEditor();
+    editorInsertRow(0, "int x = 10;", 11);
+    editorInsertRow(1, "x = x + 255;", 12);
+
+    editorFindCallback("", CTRL_KEY('r'));
+    editorFindCallback("[0-9]+", '+');
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 8);
+    editorFindCallback("[0-9]+", ARROW_DOWN);
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 8);
+    editorFindCallback("[0-9]+", ARROW_DOWN);
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 8);
+
+    // a pattern that doesn't compile finds nothing, and toggling back
+    // searches for it literally
+    editorFindCallback("x = (", '(');
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 8);
+    editorFindCallback("x = (", CTRL_KEY('r'));
+    editorFindCallback("x = x", 'x');
+    assert(E.buf->cursorY == 1 && E.buf->cursorX == 0);
+    editorFindCallback("x = x", '\r');
+}
+
+static void test_findLargeFileInBackground(void) {
+    resetEditor();
+
+    char path[] = "/tmp/test_editorXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < 400000; i++) {
+        fprintf(fp, "%s line %d\n", i == 399990 ? "needle" : "hay", i);
+    }
+    fclose(fp);
+
+    assert(editorOpenMapped(path) == 0);
+    assert(editorMapIndexing());
+    editorRowInsertChar(editorRowAt(3), 0, '>');
+
+    editorFindCallback("needle", 'e');
+    while (E.buf->cursorY != 399990) {
+        editorFindPoll();
+        usleep(1000);
+    }
+    assert(E.buf->cursorX == 0);
+
+    // the edited row is searched as it is now, the rest straight from the file
+    editorFindCallback("hay line 3", '3');
+    while (E.buf->cursorY != 3) {
+        editorFindPoll();
+        usleep(1000);
+    }
+    assert(E.buf->cursorX == 1);
+    while (E.buf->cursorY == 3) {
+        editorFindCallback("hay line 3", ARROW_DOWN);
+        editorFindPoll();
+        usleep(1000);
+    }
+    assert(E.buf->cursorY == 30 && E.buf->cursorX == 0);
+    editorFindCallback("hay line 3", '\x1b');
+
+    unlink(path);
+}
+
+// patching a row in place must give the same render and colors as redoing it
+static int findTypedFd;
+static int findNeedleLine;
+
+// types a key once the match is on screen, which is what stops editorIdle
+static void *findTypeOnMatch(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 10000 && *(volatile int *)&E.buf->cursorY != findNeedleLine; i++) {
+        usleep(1000);
+    }
+    assert(write(findTypedFd, "x", 1) == 1);
+    return NULL;
+}
+
+static void test_findWhileIndexing(void) {
+    resetEditor();
+    char path[] = "/tmp/test_editorXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    FILE *fp = fdopen(fd, "w");
+    findNeedleLine = 1000000;
+    for (int i = 0; i < 8000000; i++) {
+        fprintf(fp, "%s line %d\n", i == findNeedleLine ? "needle" : "hay", i);
+    }
+    fclose(fp);
+
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    int savedIn = dup(STDIN_FILENO);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    dup2(fds[0], STDIN_FILENO);
+    findTypedFd = fds[1];
+
+    // the match is shown as soon as the scan finds it, not once the whole
+    // file has been indexed
+    assert(editorOpenMapped(path) == 0);
+    editorFindCallback("needle", 'e');
+    pthread_t typist;
+    assert(pthread_create(&typist, NULL, findTypeOnMatch, NULL) == 0);
+    editorIdle();
+    pthread_join(typist, NULL);
+    assert(E.buf->cursorY == findNeedleLine && editorMapIndexing());
+    editorFindCallback("needle", '\x1b');
+
+    dup2(savedIn, STDIN_FILENO);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedIn);
+    close(savedOut);
+    close(devNull);
+    close(fds[0]);
+    close(fds[1]);
+    resetEditor();
+    unlink(path);
+}
+
+static void test_incrementalRowPatch(void) {
+    // the edited row starts outside and inside a multiline comment
+    char *above[] = { "int a; // open", "int a; /* open" };
+    const char alphabet[] = "ai fntr01.\t/*\"'\\ ;";
+    char render[256];
+    struct hlSpan spans[256];
+    struct rowTab tabs[128];
+    unsigned int seed = 7;
+
+    for (int variant = 0; variant < 2; variant++) {
+        resetEditor();
+        E.buf->filename = strdup("patch.c");
+        editorSelectSyntaxHighlight();
+        editorInsertRow(0, above[variant], 14);
+        editorInsertRow(1, "\tx = 1.5; // y\t\"s\" */ if", 24);
+        editorInsertRow(2, "return 0;", 9);
+
+        for (int step = 0; step < 2000; step++) {
+            erow *row = editorRowAt(1);
+            seed = seed * 1103515245 + 12345;
+            int at = (seed >> 8) % (row->size + 1);
+            if (((seed >> 20) & 3) != 0 && row->size < 80) {
+                editorRowInsertChar(row, at, alphabet[(seed >> 4) % (sizeof(alphabet) - 1)]);
+            }else if (row->size > 0) {
+                editorRowDelChar(row, at == row->size ? at - 1 : at);
+            }
+            editorSyntaxEnsure(editorRowAt(2));
+
+            int rsize = row->rsize;
+            int open = row->hlOpenComment;
+            int nrTabs = row->nrTabs;
+            memcpy(render, row->render, rsize + 1);
+            int nrHl = row->nrHl;
+            memcpy(spans, row->hl, sizeof(struct hlSpan) * nrHl);
+            memcpy(tabs, row->tabs, sizeof(struct rowTab) * nrTabs);
+
+            editorUpdateRow(row);
+            editorSyntaxEnsure(editorRowAt(2));
+            assert(row->rsize == rsize);
+            assert(memcmp(row->render, render, rsize + 1) == 0);
+            assert(row->nrHl == nrHl);
+            assert(memcmp(row->hl, spans, sizeof(struct hlSpan) * nrHl) == 0);
+            assert(row->hlOpenComment == open);
+            assert(row->nrTabs == nrTabs);
+            assert(memcmp(row->tabs, tabs, sizeof(struct rowTab) * nrTabs) == 0);
+        }
+    }
+}
+
+// column of chars[cx] worked out from the start of the row
+static int columnOf(erow *row, int cx) {
+    int col = 0;
+    for (int j = 0; j < cx; ) {
+        int cp;
+        int len = utf8Decode(&row->chars[j], row->size - j, &cp);
+        if (cp == '\t') {
+            col += TAB_STOP - col % TAB_STOP;
+        }else {
+            col += (cp < 0) ? 1 : utf8Width(cp);
+        }
+        j += len;
+    }
+    return col;
+}
+
+static void test_columnIndex(void) {
+    const char *pieces[] = { "a", "\t", "xy", "\xc3\xa9", "\xe4\xb8\xad", "\xcc\x81", "\t\tq", "\xff" };
+    unsigned int seed = 11;
+
+    resetEditor();
+    editorInsertRow(0, "\tint x;\t// tab", 14);
+    for (int step = 0; step < 3000; step++) {
+        erow *row = editorRowAt(0);
+        seed = seed * 1103515245 + 12345;
+        int at = utf8CharStart(row, (seed >> 8) % (row->size + 1));
+        if (((seed >> 20) & 3) != 0 && row->size < 120) {
+            const char *piece = pieces[(seed >> 4) % (sizeof(pieces) / sizeof(pieces[0]))];
+            editorRowSplice(row, at, 0, piece, strlen(piece));
+        }else if (at < row->size) {
+            editorRowSplice(row, at, utf8NextCharIndex(row, at) - at, NULL, 0);
+        }
+
+        // every character start maps to its column, and every column it
+        // covers maps back to it
+        for (int cx = 0; cx < row->size; cx = utf8NextCharIndex(row, cx)) {
+            int rx = columnOf(row, cx);
+            int nextRx = columnOf(row, utf8NextCharIndex(row, cx));
+            assert(editorRowCxToRx(row, cx) == rx);
+            // except for a mark the row starts with, which has no column
+            for (int col = rx; col < nextRx; col++) {
+                assert(editorRowRxToCx(row, col) == cx);
+            }
+        }
+        assert(editorRowCxToRx(row, row->size) == columnOf(row, row->size));
+        assert(editorRowRxToCx(row, 1000) == row->size);
+    }
+
+    // a long line costs a binary search, not a walk, to find the column
+    char *line = malloc(1 << 20);
+    for (int i = 0; i < (1 << 20); i++) line[i] = (i % 64 == 0) ? '\t' : 'x';
+    editorInsertRow(1, line, 1 << 20);
+    erow *row = editorRowAt(1);
+    assert(row->nrTabs == (1 << 20) / 64);
+    assert(editorRowCxToRx(row, row->size) == columnOf(row, row->size));
+    assert(editorRowRxToCx(row, editorRowCxToRx(row, 12345)) == 12345);
+    editorRowInsertChar(row, 100, '\t');
+    assert(row->nrTabs == (1 << 20) / 64 + 1);
+    assert(editorRowCxToRx(row, row->size) == columnOf(row, row->size));
+    free(line);
+}
+
+static void test_rowAllocator(void) {
+    struct rowHeap heap = {0};
+    assert(rowAllocSize(1) == 16 && rowAllocSize(17) == 32 && rowAllocSize(100) == 128);
+    assert(rowAllocSize(4096) == 4096 && rowAllocSize(5000) == 5000);
+
+    // a freed block is the next one handed out of its class
+    char *a = rowAlloc(&heap, ROW_CHARS, 40);
+    char *b = rowAlloc(&heap, ROW_CHARS, 40);
+    assert(a != b && heap.slabBytes == ROW_SLAB_SIZE);
+    rowFree(&heap, ROW_CHARS, a, 40);
+    assert(rowAlloc(&heap, ROW_CHARS, 48) == a);
+
+    memset(b, 'x', 40);
+    b = rowRealloc(&heap, ROW_CHARS, b, 40, 6000);
+    assert(b[0] == 'x' && b[39] == 'x' && heap.largeBytes == 6000);
+    b = rowRealloc(&heap, ROW_CHARS, b, 6000, 100);
+    assert(b[39] == 'x' && heap.largeBytes == 0);
+    assert(heap.used[ROW_CHARS] == 48 + 128 && heap.blocks[ROW_CHARS] == 2);
+    rowFree(&heap, ROW_CHARS, b, 100);
+    rowFree(&heap, ROW_CHARS, a, 48);
+    rowHeapRelease(&heap);
+
+    // every row buffer is accounted for, and closing the file frees them all
+    resetEditor();
+    char line[10000];
+    memset(line, '\t', sizeof(line));
+    editorInsertRow(0, "hello", 5);
+    editorInsertRow(1, line, 9000);
+    editorInsertRow(2, "\xe4\xb8\xad\t", 4);
+    for (int i = 0; i < 200; i++) editorRowInsertChar(editorRowAt(0), 0, 'a');
+    size_t chars = 0, render = 0;
+    for (int i = 0; i < E.buf->nrRows; i++) {
+        chars += rowAllocSize(editorRowAt(i)->charsCap);
+        render += rowAllocSize(editorRowAt(i)->renderCap);
+    }
+    assert(E.buf->heap.used[ROW_CHARS] == chars && E.buf->heap.used[ROW_RENDER] == render);
+    assert(E.buf->heap.blocks[ROW_COLS] == 1 && E.buf->heap.blocks[ROW_TABS] == 2);
+    assert(strncmp(editorRowAt(0)->chars, "aaaa", 4) == 0 && editorRowAt(0)->size == 205);
+
+    FILE *report = tmpfile();
+    editorMemoryReport(fileno(report));
+    rewind(report);
+    char text[1024];
+    size_t n = fread(text, 1, sizeof(text) - 1, report);
+    text[n] = '\0';
+    fclose(report);
+    assert(strstr(text, "memory: ") && strstr(text, "chars") && strstr(text, "row nodes"));
+
+    editorDelRow(1);
+    assert(E.buf->heap.largeBytes == 0);
+    editorCloseFile();
+    for (int k = 0; k < ROW_KINDS; k++) assert(E.buf->heap.used[k] == 0 && E.buf->heap.blocks[k] == 0);
+    assert(E.buf->heap.slabBytes == 0);
+}
+
+static void test_frameDiffing(void) {
+    resetEditor();
+    for (int i = 0; i < 30; i++) {
+        editorInsertRow(i, "some text on a line", 19);
+    }
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+
+    screenInvalidate();
+    editorRefreshScreen();
+    int full = E.frameBytes;
+
+    // nothing changed: nothing is written
+    editorRefreshScreen();
+    assert(E.frameBytes == 0);
+
+    // one character changed: a cursor move and a few bytes
+    editorRowInsertChar(editorRowAt(3), 19, 'x');
+    editorRefreshScreen();
+    assert(E.frameBytes > 0 && E.frameBytes < 64);
+    assert(E.frameBytes * 20 < full);
+
+    // moving the cursor repositions it and touches the status bar count
+    E.buf->cursorY = 5;
+    editorRefreshScreen();
+    assert(E.frameBytes > 0 && E.frameBytes < 48);
+
+    screenInvalidate();
+    editorRefreshScreen();
+    assert(E.frameBytes >= full - 16);
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devNull);
+}
+
+static void test_frameAllocations(void) {
+    resetEditor();
+    for (int i = 0; i < 60; i++) {
+        editorInsertRow(i, "\tint value = 42; // a comment", 29);
+    }
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+
+    // the first full repaint sizes the frame buffer
+    screenInvalidate();
+    editorRefreshScreen();
+
+    long allocs = E.frameAllocs;
+    for (int i = 0; i < 50; i++) {
+        E.buf->cursorY = i;
+        editorRowInsertChar(editorRowAt(i), 1, 'x');
+        editorRefreshScreen();
+        screenInvalidate();
+        editorRefreshScreen();
+    }
+    assert(E.frameAllocs == allocs);
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devNull);
+}
+
+static char *readWholeFile(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "r");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    rewind(fp);
+    char *buf = malloc(*len + 1);
+    assert(fread(buf, 1, *len, fp) == *len);
+    fclose(fp);
+    return buf;
+}
+
+static void test_save(void) {
+    resetEditor();
+
+    char path[] = "/tmp/test_editorXXXXXX.txt";
+    int fd = mkstemps(path, 4);
+    assert(fd != -1);
+    close(fd);
+
+    editorInsertRow(0, "small", 5);
+    editorInsertRow(1, "", 0);
+    E.buf->filename = strdup(path);
+    editorSave();
+    assert(!editorSavePoll());
+    assert(E.buf->dirty == 0);
+    size_t len;
+    char *buf = readWholeFile(path, &len);
+    assert(len == 7 && memcmp(buf, "small\n\n", 7) == 0);
+    free(buf);
+
+    // a big file is written on a thread while it can still be edited
+    resetEditor();
+    FILE *fp = fopen(path, "w");
+    for (int i = 0; i < 500000; i++) {
+        fprintf(fp, "line %d\r\n", i);
+    }
+    fprintf(fp, "last");
+    fclose(fp);
+    chmod(path, 0640);
+
+    assert(editorOpenMapped(path) == 0);
+    assert(editorMapIndexing());
+    editorRowInsertChar(editorRowAt(3), 0, '>');
+    editorRowInsertChar(editorRowAt(4), 0, '>');
+    editorSave();
+    assert(strncmp(E.statusMSG, "Saving", 6) == 0);
+    editorRowInsertChar(editorRowAt(3), 0, '#');
+    editorDelRow(4);
+    while (editorSavePoll()) {
+        usleep(1000);
+    }
+    assert(strstr(E.statusMSG, "bytes written") != NULL);
+    assert(E.buf->dirty == 2);
+    assert(strcmp(editorRowAt(3)->chars, "#>line 3") == 0);
+
+    char *expected = malloc(len = 16 << 20);
+    size_t at = 0;
+    for (int i = 0; i < 500000; i++) {
+        at += snprintf(&expected[at], len - at, "%sline %d\n", (i == 3 || i == 4) ? ">" : "", i);
+    }
+    at += snprintf(&expected[at], len - at, "last\n");
+    buf = readWholeFile(path, &len);
+    assert(len == at && memcmp(buf, expected, len) == 0);
+    free(buf);
+    free(expected);
+
+    struct stat st;
+    assert(stat(path, &st) == 0 && (st.st_mode & 0777) == 0640);
+    // the mapping still shows the file as it was opened
+    editorMapFinishIndex();
+    assert(memcmp(editorRowAt(400000)->chars, "line 400001", 11) == 0);
+
+    resetEditor();
+    unlink(path);
+}
+
+static void test_undoRedo(void) {
+    resetEditor();
+    editorInsertRow(0, "int x;", 6);
+    editorInsertRow(1, "return x;", 9);
+    editorUndoSeal();
+
+    // typing is one step, and one op however long it gets
+    E.buf->cursorY = 0;
+    E.buf->cursorX = 5;
+    size_t before = editorUndoBytes();
+    for (int i = 0; i < 100; i++) {
+        editorInserChar('y');
+    }
+    assert(editorUndoBytes() - before < 100 + 64);
+    editorUndoSeal();
+    for (int i = 0; i < 3; i++) {
+        editorDelChar();
+    }
+    assert(editorRowAt(0)->size == 103);
+
+    assert(editorUndo());
+    assert(editorRowAt(0)->size == 106);
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 105);
+    assert(editorUndo());
+    assert(strcmp(editorRowAt(0)->chars, "int x;") == 0);
+    assert(strcmp(editorRowAt(0)->render, "int x;") == 0);
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 5);
+    assert(editorRedo());
+    assert(editorRowAt(0)->size == 106);
+    assert(E.buf->cursorX == 105);
+
+    // splitting and joining rows
+    editorUndoSeal();
+    E.buf->cursorX = 3;
+    editorInsertNewLine();
+    assert(E.buf->nrRows == 3 && strcmp(editorRowAt(0)->chars, "int") == 0);
+    editorUndoSeal();
+    E.buf->cursorY = 2;
+    E.buf->cursorX = 0;
+    editorDelChar();
+    assert(E.buf->nrRows == 2 && strcmp(&editorRowAt(1)->chars[103], "return x;") == 0);
+    assert(editorUndo());
+    assert(E.buf->nrRows == 3 && strcmp(editorRowAt(2)->chars, "return x;") == 0);
+    assert(editorUndo());
+    assert(E.buf->nrRows == 2 && editorRowAt(0)->size == 106);
+    assert(E.buf->cursorY == 0 && E.buf->cursorX == 3);
+
+    // a new edit drops what could have been redone
+    editorInserChar('!');
+    editorUndoSeal();
+    assert(!editorRedo());
+    assert(editorUndo() && editorUndo() && editorUndo());
+    assert(E.buf->nrRows == 0);
+    assert(!editorUndo());
+
+    // a log over budget forgets its oldest steps, never the current one
+    resetEditor();
+    editorUndoSetBudget(4096);
+    char line[200];
+    memset(line, 'z', sizeof(line));
+    for (int i = 0; i < 500; i++) {
+        editorInsertRow(i, line, sizeof(line));
+        editorUndoSeal();
+        assert(editorUndoBytes() <= 4096);
+    }
+    int undone = 0;
+    while (editorUndo()) undone++;
+    assert(undone > 0 && undone < 500);
+    assert(E.buf->nrRows == 500 - undone);
+    while (editorRedo()) undone--;
+    assert(undone == 0 && E.buf->nrRows == 500);
+
+    for (int i = 0; i < 64; i++) {
+        editorInsertRow(0, line, sizeof(line));
+    }
+    assert(editorUndoBytes() > 4096);
+    editorUndo();
+    assert(E.buf->nrRows == 500);
+    editorUndoSetBudget(UNDO_BUDGET);
+}
+
+static void test_buffers(void) {
+    resetEditor();
+    char path[] = "/tmp/test_editorXXXXXX.c";
+    int fd = mkstemps(path, 2);
+    assert(fd != -1);
+    assert(write(fd, "int a;\nint b;\n", 14) == 14);
+    close(fd);
+
+    // the first file goes into the empty buffer, a new name gets its own
+    editorBufferOpen(path);
+    assert(E.nrBuffers == 1 && E.buf->nrRows == 2 && E.buf->syntax != NULL);
+    struct editorBuffer *first = E.buf;
+    E.buf->cursorY = 1;
+    E.buf->cursorX = 3;
+    editorInserChar('x');
+    editorBufferOpen("/tmp/test_editor_no_such_file.txt");
+    assert(E.nrBuffers == 2 && E.buf != first);
+    assert(E.buf->nrRows == 0 && E.buf->dirty == 0 && E.buf->syntax == NULL);
+    editorInsertRow(0, "other", 5);
+
+    // each buffer keeps its rows, cursor and undo log
+    editorBufferSwitch(0);
+    assert(E.buf == first && E.buf->cursorY == 1 && E.buf->cursorX == 4);
+    assert(strcmp(editorRowAt(1)->chars, "intx b;") == 0);
+    assert(editorUndo());
+    assert(strcmp(editorRowAt(1)->chars, "int b;") == 0);
+    assert(!editorUndo());
+    editorBufferSwitch(1);
+    assert(E.buf->nrRows == 1 && strcmp(editorRowAt(0)->chars, "other") == 0);
+
+    // opening a name that is already open shows its buffer, however the
+    // path to it is spelled
+    editorBufferOpen(path);
+    assert(E.nrBuffers == 2 && E.buf == first && editorBufferIndex() == 0);
+    char other[64];
+    snprintf(other, sizeof(other), "/tmp/../tmp/.%s", strrchr(path, '/'));
+    editorBufferSwitch(1);
+    editorBufferOpen(other);
+    assert(E.nrBuffers == 2 && E.buf == first);
+    char link[] = "/tmp/test_editor_linkXXXXXX";
+    assert(mkdtemp(link) != NULL);
+    char linked[64];
+    snprintf(linked, sizeof(linked), "%s/linked.c", link);
+    assert(symlink(path, linked) == 0);
+    editorBufferSwitch(1);
+    editorBufferOpen(linked);
+    assert(E.nrBuffers == 2 && E.buf == first);
+    unlink(linked);
+    rmdir(link);
+
+    // closing the shown buffer shows its neighbour and frees its rows
+    editorBufferClose(0);
+    assert(E.nrBuffers == 1 && E.buf->nrRows == 1);
+    assert(E.buf->heap.used[ROW_CHARS] > 0);
+    editorBufferClose(0);
+    assert(E.nrBuffers == 0 && E.buf == NULL);
+    unlink(path);
+}
+
+static void test_pasteInsertsBlock(void) {
+    resetEditor();
+    editorInsertRow(0, "int main() {}", 13);
+    E.buf->cursorY = 0;
+    E.buf->cursorX = 12;
+    editorUndoSeal();
+
+    const char *text = "\r\n\treturn 0;\r\n\r\n\tx++;\n";
+    editorInsertText(text, strlen(text));
+    assert(E.buf->nrRows == 5);
+    assert(strcmp(editorRowAt(0)->chars, "int main() {") == 0);
+    assert(strcmp(editorRowAt(1)->chars, "\treturn 0;") == 0);
+    assert(editorRowAt(2)->size == 0);
+    assert(strcmp(editorRowAt(3)->chars, "\tx++;") == 0);
+    assert(strcmp(editorRowAt(4)->chars, "}") == 0);
+    assert(E.buf->cursorY == 4 && E.buf->cursorX == 0);
+
+    editorUndoSeal();
+    assert(editorUndo());
+    assert(E.buf->nrRows == 1 && strcmp(editorRowAt(0)->chars, "int main() {}") == 0);
+
+    // through the key reader, with the end mark cut across reads
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    int saved = dup(STDIN_FILENO);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    dup2(fds[0], STDIN_FILENO);
+    static char input[8192];
+    for (int bodyLen = 4085; bodyLen < 4100; bodyLen++) {
+        resetEditor();
+        size_t len = 0;
+        len += sprintf(&input[len], "\x1b[200~");
+        memset(&input[len], 'a', bodyLen - 2);
+        len += bodyLen - 2;
+        len += sprintf(&input[len], "\rb\x1b[201~c\x1b[A");
+        assert(write(fds[1], input, len) == (ssize_t)len);
+
+        editorProcessKeypress();
+        assert(E.buf->nrRows == 2 && editorRowAt(0)->size == bodyLen - 2);
+        assert(strcmp(editorRowAt(1)->chars, "b") == 0);
+        editorProcessKeypress();
+        assert(strcmp(editorRowAt(1)->chars, "bc") == 0);
+        assert(editorReadKey() == ARROW_UP);
+    }
+    dup2(saved, STDIN_FILENO);
+    dup2(savedOut, STDOUT_FILENO);
+    close(saved);
+    close(savedOut);
+    close(devNull);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_eventLoop(void) {
+    resetEditor();
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    int savedIn = dup(STDIN_FILENO);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    dup2(fds[0], STDIN_FILENO);
+
+    // keys that are already waiting are drawn in one frame
+    assert(write(fds[1], "hello\rworld", 11) == 11);
+    long frames = E.frames;
+    editorProcessInput();
+    assert(E.buf->nrRows == 2 && strcmp(editorRowAt(1)->chars, "world") == 0);
+    assert(E.frames == frames + 1);
+    assert(write(fds[1], "!", 1) == 1);
+    editorProcessInput();
+    assert(strcmp(editorRowAt(1)->chars, "world!") == 0);
+    assert(E.frames == frames + 2);
+
+    // a status message is cleared by its timer
+    editorSetStatusMessage("hello");
+    assert(!editorTimersFire(0));
+    assert(strcmp(E.statusMSG, "hello") == 0);
+    assert(editorTimersFire(1e18));
+    assert(E.statusMSG[0] == '\0');
+
+    dup2(savedIn, STDIN_FILENO);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedIn);
+    close(savedOut);
+    close(devNull);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_utf8(void) {
+    int cp;
+    assert(utf8Decode("\xc3\xa9", 2, &cp) == 2 && cp == 0xe9);
+    assert(utf8Decode("\xe4\xb8\xad", 3, &cp) == 3 && cp == 0x4e2d);
+    assert(utf8Decode("\xf0\x9f\x98\x80", 4, &cp) == 4 && cp == 0x1f600);
+    // overlong, surrogate, cut off and stray bytes are taken one at a time
+    assert(utf8Decode("\xc0\xaf", 2, &cp) == 1 && cp == -1);
+    assert(utf8Decode("\xed\xa0\x80", 3, &cp) == 1 && cp == -1);
+    assert(utf8Decode("\xe4\xb8", 2, &cp) == 1 && cp == -1);
+    assert(utf8Decode("\x80", 1, &cp) == 1 && cp == -1);
+    assert(utf8Width('a') == 1 && utf8Width(0x4e2d) == 2);
+    assert(utf8Width(0x301) == 0 && utf8Width(0x1f600) == 2);
+
+    // the vector scan stops where a byte loop would
+    char buf[200];
+    memset(buf, 'a', sizeof(buf));
+    for (size_t len = 0; len <= sizeof(buf); len++) {
+        for (size_t at = 0; at <= len; at++) {
+            if (at < len) buf[at] = (char)0xc3;
+            assert(utf8AsciiPrefix(buf, len) == at);
+            if (at < len) buf[at] = 'a';
+        }
+    }
+
+    // a, e acute, a wide CJK character, a tab and b
+    resetEditor();
+    editorInsertRow(0, "a\xc3\xa9\xe4\xb8\xad\tb", 8);
+    erow *row = editorRowAt(0);
+    assert(row->renderCols && row->rsize == 11 && row->renderCols[row->rsize] == 9);
+    int cx[] = { 0, 1, 3, 6, 7, 8 };
+    int rx[] = { 0, 1, 2, 4, 8, 9 };
+    for (int i = 0; i < 6; i++) {
+        assert(editorRowCxToRx(row, cx[i]) == rx[i]);
+        if (i < 5) assert(utf8NextCharIndex(row, cx[i]) == cx[i + 1]);
+        if (i > 0) assert(utf8PrevCharIndex(row, cx[i]) == cx[i - 1]);
+    }
+    assert(editorRowRxToCx(row, 3) == 3 && editorRowRxToCx(row, 5) == 6);
+    assert(editorRowRxToCx(row, 8) == 7 && editorRowRxToCx(row, 20) == 8);
+    assert(utf8CharStart(row, 4) == 3 && utf8CharStart(row, 5) == 3);
+
+    // a combining mark goes with the letter before it
+    editorInsertRow(1, "e\xcc\x81x", 4);
+    row = editorRowAt(1);
+    assert(utf8NextCharIndex(row, 0) == 3 && utf8PrevCharIndex(row, 3) == 0);
+    assert(editorRowCxToRx(row, 3) == 1 && utf8CharStart(row, 1) == 0);
+
+    // backspace takes the whole character; a row that is ASCII again
+    // drops its column map
+    E.buf->cursorY = 0;
+    E.buf->cursorX = 6;
+    editorDelChar();
+    row = editorRowAt(0);
+    assert(E.buf->cursorX == 3 && row->size == 5);
+    E.buf->cursorX = 3;
+    editorDelChar();
+    assert(E.buf->cursorX == 1 && strcmp(row->chars, "a\tb") == 0);
+    assert(row->renderCols == NULL && row->rsize == 9);
+
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    char path[] = "/tmp/editor_utf8_XXXXXX";
+    int out = mkstemp(path);
+    dup2(out, STDOUT_FILENO);
+    int savedIn = dup(STDIN_FILENO);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    dup2(fds[0], STDIN_FILENO);
+
+    // a typed multibyte character goes in as one
+    E.buf->cursorY = 2;
+    E.buf->cursorX = 0;
+    assert(write(fds[1], "\xe4\xb8\xad!", 4) == 4);
+    editorProcessInput();
+    assert(strcmp(editorRowAt(2)->chars, "\xe4\xb8\xad!") == 0 && E.buf->cursorX == 4);
+
+    // the frame carries the character; changing the text after it only
+    // rewrites the change, not the whole line
+    screenInvalidate();
+    editorRefreshScreen();
+    editorRowInsertChar(editorRowAt(2), 4, '?');
+    editorRefreshScreen();
+    assert(E.frameBytes > 0 && E.frameBytes < 64);
+
+    dup2(savedIn, STDIN_FILENO);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedIn);
+    close(savedOut);
+    close(fds[0]);
+    close(fds[1]);
+
+    char frame[8192];
+    ssize_t len = pread(out, frame, sizeof(frame) - 1, 0);
+    assert(len > 0);
+    frame[len] = '\0';
+    assert(strstr(frame, "\xe4\xb8\xad!") && strstr(frame, "e\xcc\x81x"));
+    close(out);
+    unlink(path);
+}
+
+static int countNodes(int *materialized) {
+    int nodes = 0;
+    *materialized = 0;
+    for (rowNode *node = rowTreeAt(&E.buf->rows, 0, NULL); node; node = rowTreeNext(node)) {
+        nodes++;
+        if (node->span == 0) (*materialized)++;
+    }
+    return nodes;
+}
+
+static void test_pager(void) {
+    resetEditor();
+    char path[] = "/tmp/test_editorXXXXXX.c";
+    int fd = mkstemps(path, 2);
+    assert(fd != -1);
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < 30000; i++) {
+        fprintf(fp, "int line%d; /* of the log */\n", i);
+    }
+    fclose(fp);
+
+    // even a small file is mapped, and a missing one isn't opened at all
+    E.pager = 1;
+    editorBufferOpen("/tmp/test_editor_no_such_file.txt");
+    assert(E.nrBuffers == 1 && E.buf->filename == NULL && strstr(E.statusMSG, "Can't open"));
+    editorBufferOpen(path);
+    assert(E.buf->readOnly && E.buf->map.data != NULL);
+    editorMapFinishIndex();
+    assert(E.buf->nrRows == 30000);
+
+    // paging through keeps the rows near the screen and no more
+    size_t slabs = 0;
+    for (int top = 0; top + E.screenrows <= E.buf->nrRows; top += 53) {
+        E.buf->rowOff = E.buf->cursorY = top;
+        for (int y = top; y < top + E.screenrows; y++) {
+            editorSyntaxEnsure(editorRowAt(y));
+        }
+        editorPagerTrim();
+        int materialized;
+        int nodes = countNodes(&materialized);
+        assert(materialized <= 2 * 512 + E.screenrows);
+        assert(nodes <= 2 * (2 * 512 + E.screenrows) + 2);
+        if (slabs == 0 && top >= E.buf->nrRows / 2) slabs = E.buf->heap.slabBytes;
+    }
+    assert(slabs > 0 && E.buf->heap.slabBytes == slabs);
+    erow *row = editorRowAt(7);
+    assert(row->size == 27 && memcmp(row->chars, "int line7; /* of the log */", 27) == 0);
+    editorSyntaxEnsure(row);
+    assert(editorRowHighlightAt(row, 0) == HL_KEYWORD2);
+
+    // typing doesn't edit, and less's keys move around
+    int savedIn = dup(STDIN_FILENO);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    dup2(fds[0], STDIN_FILENO);
+    E.buf->cursorY = E.buf->cursorX = 0;
+    assert(write(fds[1], "xG", 2) == 2);
+    editorProcessKeypress();
+    assert(editorRowAt(0)->size == 27 && E.buf->dirty == 0 && strstr(E.statusMSG, "Read-only"));
+    editorSave();
+    editorProcessKeypress();
+    assert(E.buf->cursorY == 29999);
+    assert(write(fds[1], "g", 1) == 1);
+    editorProcessKeypress();
+    assert(E.buf->cursorY == 0);
+    dup2(savedIn, STDIN_FILENO);
+    close(savedIn);
+    close(fds[0]);
+    close(fds[1]);
+    unlink(path);
+}
+
+static void appendTo(const char *path, const char *mode, const char *text) {
+    FILE *fp = fopen(path, mode);
+    assert(fp != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static void test_follow(void) {
+    resetEditor();
+    char path[] = "/tmp/test_editorXXXXXX.log";
+    int fd = mkstemps(path, 4);
+    assert(fd != -1);
+    close(fd);
+    appendTo(path, "w", "one\ntwo\nthr");
+
+    // a followed file opens at its end, mapped however small
+    E.follow = 1;
+    editorBufferOpen(path);
+    assert(E.buf->map.data != NULL && E.buf->nrRows == 3 && E.buf->cursorY == 2);
+    assert(editorRowAt(2)->size == 3);
+    assert(editorFollowPoll() == 0);
+
+    // the cut off line grows in place and the cursor follows the new end
+    appendTo(path, "a", "ee\nfour\n");
+    assert(editorFollowPoll() == 1);
+    assert(E.buf->nrRows == 4 && E.buf->cursorY == 3);
+    assert(editorRowAt(2)->size == 5 && memcmp(editorRowAt(2)->chars, "three", 5) == 0);
+    assert(editorRowAt(3)->size == 4 && memcmp(editorRowAt(3)->chars, "four", 4) == 0);
+
+    // a burst of lines goes in as one span
+    int materialized;
+    int nodes = countNodes(&materialized);
+    char *burst = malloc(1000 * 16);
+    size_t at = 0;
+    for (int i = 0; i < 1000; i++) at += sprintf(&burst[at], "burst %d\n", i);
+    appendTo(path, "a", burst);
+    free(burst);
+    assert(editorFollowPoll() == 1);
+    assert(E.buf->nrRows == 1004 && E.buf->cursorY == 1003 && countNodes(&materialized) == nodes + 1);
+    assert(memcmp(editorRowAt(1003)->chars, "burst 999", 9) == 0);
+
+    // the cursor stays put when it isn't on the last line
+    E.buf->cursorY = 10;
+    appendTo(path, "a", "more\n");
+    assert(editorFollowPoll() == 1);
+    assert(E.buf->nrRows == 1005 && E.buf->cursorY == 10);
+
+    // a rewrite reloads the file
+    appendTo(path, "w", "new\n");
+    assert(editorFollowPoll() == 1);
+    assert(E.buf->nrRows == 1 && E.buf->cursorY == 1 && memcmp(editorRowAt(0)->chars, "new", 3) == 0);
+
+    // the editor's own save isn't taken for a change, but an append to
+    // the file it wrote is
+    editorRowInsertChar(editorRowAt(0), 0, '>');
+    editorSave();
+    assert(E.buf->dirty == 0);
+    assert(editorFollowPoll() == 0 && editorRowAt(0)->size == 4);
+    appendTo(path, "a", "x\n");
+    assert(editorFollowPoll() == 1);
+    assert(E.buf->nrRows == 2 && memcmp(editorRowAt(0)->chars, ">new", 4) == 0);
+
+    // unsaved changes are never reloaded over
+    editorRowInsertChar(editorRowAt(1), 0, '#');
+    appendTo(path, "a", "y\n");
+    editorFollowPoll();
+    assert(E.buf->nrRows == 2 && strstr(E.statusMSG, "changed on disk"));
+
+    // an edited buffer no longer reads from the file, so cutting the file
+    // short under it loses nothing
+    resetEditor();
+    E.follow = 1;
+    FILE *fp = fopen(path, "w");
+    for (int i = 0; i < 200000; i++) {
+        fprintf(fp, "kept line %d\n", i);
+    }
+    fclose(fp);
+    editorBufferOpen(path);
+    assert(E.buf->map.data != NULL && !E.buf->map.copied);
+    E.buf->cursorY = E.buf->cursorX = 0;
+    editorInserChar('x');
+    assert(E.buf->map.copied);
+    assert(truncate(path, 0) == 0);
+    editorFollowPoll();
+    assert(strstr(E.statusMSG, "changed on disk") && E.buf->nrRows == 200000);
+    assert(memcmp(editorRowAt(0)->chars, "xkept line 0", 12) == 0);
+    assert(editorRowAt(150000)->size == 16 && memcmp(editorRowAt(150000)->chars, "kept line 150000", 16) == 0);
+
+    resetEditor();
+    unlink(path);
+}
+
+static void test_replay(void) {
+    resetEditor();
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    int savedIn = dup(STDIN_FILENO);
+    FILE *keys = tmpfile();
+    fputs("ab\rc\x1b[A", keys);
+    fflush(keys);
+    rewind(keys);
+    dup2(fileno(keys), STDIN_FILENO);
+
+    // one frame per key, on the size asked for, until the keys run out
+    editorReplayBegin(10, 40);
+    assert(E.screenrows == 8 && E.screencols == 40);
+    long frames = E.frames;
+    int steps = 0;
+    while (editorReplayStep()) steps++;
+    assert(steps == 5 && E.frames == frames + 5);
+    assert(E.buf->nrRows == 2 && strcmp(editorRowAt(0)->chars, "ab") == 0);
+    assert(strcmp(editorRowAt(1)->chars, "c") == 0 && E.buf->cursorY == 0);
+
+    FILE *report = tmpfile();
+    editorReplayReport(fileno(report));
+    rewind(report);
+    char line[256];
+    assert(fgets(line, sizeof(line), report) && strncmp(line, "replay: 5 keys", 14) == 0);
+    assert(fgets(line, sizeof(line), report) && strstr(line, "p50") && strstr(line, "p99") && strstr(line, "max"));
+
+    // a background save started by the last key is finished before the run ends
+    resetEditor();
+    char path[] = "/tmp/test_editorXXXXXX.txt";
+    int fd = mkstemps(path, 4);
+    assert(fd != -1);
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < 500000; i++) {
+        fprintf(fp, "replayed line %d\n", i);
+    }
+    fclose(fp);
+    editorBufferOpen(path);
+    FILE *saveKeys = tmpfile();
+    fputs("X\x13", saveKeys);
+    fflush(saveKeys);
+    rewind(saveKeys);
+    dup2(fileno(saveKeys), STDIN_FILENO);
+    editorReplayBegin(10, 40);
+    while (editorReplayStep());
+    assert(editorSavePoll() == 0 && E.buf->dirty == 0);
+    fp = fopen(path, "r");
+    assert(fgets(line, sizeof(line), fp) && strcmp(line, "Xreplayed line 0\n") == 0);
+    fclose(fp);
+    fclose(saveKeys);
+    resetEditor();
+    unlink(path);
+
+    dup2(savedIn, STDIN_FILENO);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedIn);
+    close(savedOut);
+    close(devNull);
+    fclose(keys);
+    fclose(report);
+}
+
+static void test_perfHud(void) {
+    resetEditor();
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    int savedIn = dup(STDIN_FILENO);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    dup2(fds[0], STDIN_FILENO);
+
+    perfEnable(1, 1);
+    double frame, phases[PERF_PHASES], bytes;
+    int before = perfRolling(&frame, phases, &bytes);
+    assert(write(fds[1], "hello\rworld", 11) == 11);
+    editorProcessInput();
+    assert(perfRolling(&frame, phases, &bytes) == before + 1);
+    assert(phases[PERF_EDIT] > 0 && phases[PERF_DRAW] > 0 && phases[PERF_WRITE] > 0);
+    assert(phases[PERF_WAIT] == 0 && bytes > 0);
+    double sum = 0;
+    for (int i = 0; i < PERF_PHASES; i++) sum += phases[i];
+    assert(frame > 0 && frame >= sum * 0.999 && frame <= sum * 1.001);
+
+    // a redraw made while idle isn't a frame
+    perfPush(PERF_IDLE);
+    editorRefreshScreen();
+    perfPop();
+    assert(perfRolling(&frame, phases, &bytes) == before + 1);
+
+    char hud[80];
+    int len = perfHudText(hud, sizeof(hud));
+    assert(len == (int)strlen(hud) && strstr(hud, "ms in") && strstr(hud, "kB"));
+
+    char path[] = "/tmp/test_editor_traceXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    assert(perfWriteTrace(path) == 0);
+    FILE *fp = fopen(path, "r");
+    char trace[1 << 16];
+    size_t n = fread(trace, 1, sizeof(trace) - 1, fp);
+    trace[n] = '\0';
+    fclose(fp);
+    unlink(path);
+    assert(strncmp(trace, "{\"displayTimeUnit\"", 18) == 0);
+    assert(strstr(trace, "\"name\":\"drawRows\",\"ph\":\"X\""));
+    assert(strstr(trace, "\"name\":\"frame\""));
+    assert(n >= 3 && strcmp(&trace[n - 3], "]}\n") == 0);
+
+    dup2(savedIn, STDIN_FILENO);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedIn);
+    close(savedOut);
+    close(devNull);
+    close(fds[0]);
+    close(fds[1]);
 }
 
 int main(void) {
     printf("Running editor tests...\n");
     test_inserAndDeleteRows();
+    test_rowTreeMatchesArray();
+    test_openMappedIsLazy();
+    test_lineScannersAgree();
+    test_lazyHighlightPropagation();
+    test_parallelHighlight();
+    test_keywordTrie();
+    test_substringEnginesAgree();
+    test_findIncremental();
+    test_automaton();
+    test_findRegex();
+    test_findLargeFileInBackground();
+    test_findWhileIndexing();
+    test_incrementalRowPatch();
+    test_columnIndex();
+    test_rowAllocator();
+    test_frameDiffing();
+    test_frameAllocations();
+    test_save();
+    test_undoRedo();
+    test_buffers();
+    test_pasteInsertsBlock();
+    test_eventLoop();
+    test_utf8();
+    test_pager();
+    test_follow();
+    test_replay();
+    test_perfHud();
 
     printf("All tests passed\n");
     return 0;